@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+enum bench_format {
+	FORMAT_TEXT,
+	FORMAT_CSV,
+	FORMAT_JSON,
+};
+
+static const char *suite;
+static unsigned int warmup = 3;
+static unsigned int reps = 21;
+static enum bench_format format = FORMAT_TEXT;
+static unsigned int nresults; /* Benchmarks reported so far */
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-w warmup] [-r reps] [-f text|csv|json]\n",
+		prog);
+	exit(1);
+}
+
+void bench_init(int argc, char **argv, const char *name)
+{
+	int opt;
+
+	suite = name;
+	while ((opt = getopt(argc, argv, "w:r:f:")) != -1) {
+		switch (opt) {
+		case 'w':
+			warmup = atoi(optarg);
+			break;
+		case 'r':
+			reps = atoi(optarg);
+			if (reps == 0)
+				usage(argv[0]);
+			break;
+		case 'f':
+			if (!strcmp(optarg, "text"))
+				format = FORMAT_TEXT;
+			else if (!strcmp(optarg, "csv"))
+				format = FORMAT_CSV;
+			else if (!strcmp(optarg, "json"))
+				format = FORMAT_JSON;
+			else
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+}
+
+uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Value below which lie @p percent of the sorted @samples (nearest rank) */
+static double percentile(const double *samples, unsigned int n, unsigned int p)
+{
+	unsigned int rank = (n * p + 99) / 100;
+
+	return samples[rank ? rank - 1 : 0];
+}
+
+void bench_run(const char *name, const char *unit, bench_sample_t sample,
+	       void *arg)
+{
+	double *samples = malloc(reps * sizeof(*samples));
+	double median, p99;
+
+	if (samples == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+
+	for (unsigned int i = 0; i < warmup; i++)
+		sample(arg);
+	for (unsigned int i = 0; i < reps; i++)
+		samples[i] = sample(arg);
+
+	qsort(samples, reps, sizeof(*samples), compare);
+	median = percentile(samples, reps, 50);
+	p99 = percentile(samples, reps, 99);
+
+	switch (format) {
+	case FORMAT_TEXT:
+		if (nresults == 0)
+			printf("%-16s %-24s %-8s %10s %10s %10s %10s\n", "suite",
+			       "benchmark", "unit", "median", "p99", "min",
+			       "max");
+		printf("%-16s %-24s %-8s %10.1f %10.1f %10.1f %10.1f\n", suite,
+		       name, unit, median, p99, samples[0], samples[reps - 1]);
+		break;
+	case FORMAT_CSV:
+		if (nresults == 0)
+			printf("suite,benchmark,unit,reps,median,p99,min,max\n");
+		printf("%s,%s,%s,%u,%.1f,%.1f,%.1f,%.1f\n", suite, name, unit,
+		       reps, median, p99, samples[0], samples[reps - 1]);
+		break;
+	case FORMAT_JSON:
+		printf("%s{\"suite\":\"%s\",\"benchmark\":\"%s\",\"unit\":\"%s\","
+		       "\"reps\":%u,\"median\":%.1f,\"p99\":%.1f,\"min\":%.1f,"
+		       "\"max\":%.1f}", nresults ? ",\n" : "[\n", suite, name,
+		       unit, reps, median, p99, samples[0], samples[reps - 1]);
+		break;
+	}
+	fflush(stdout);
+	nresults++;
+	free(samples);
+}
+
+void bench_finish(void)
+{
+	if (format == FORMAT_JSON)
+		printf(nresults ? "\n]\n" : "[]\n");
+}
@@ -0,0 +1,63 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stdint.h>
+
+/*
+ * Microbenchmark harness
+ *
+ * Shared by the bench_*.c programs. A benchmark is a function measuring one
+ * sample, i.e. the cost of one operation averaged over a batch of them, which
+ * the harness calls a few times to warm up, then a number of times to collect
+ * the samples it reports the median, 99th percentile, minimum and maximum of.
+ *
+ * Every program takes the same options:
+ *   -w N  number of warmup samples (default 3)
+ *   -r N  number of samples (default 21)
+ *   -f F  output format: text (default), csv or json
+ *
+ * Results are meant to be compared against a baseline, e.g. saved from
+ * `make bench BENCHFLAGS="-f csv"` before the change being measured.
+ */
+
+/*
+ * bench_sample_t - Function measuring one sample of a benchmark
+ * @arg: Argument given to bench_run()
+ *
+ * Return: Cost of one operation, in the unit given to bench_run()
+ */
+typedef double (*bench_sample_t)(void *arg);
+
+/*
+ * bench_init - Parse the options of a benchmark program
+ * @argc: Argument count of main()
+ * @argv: Arguments of main()
+ * @suite: Name of the program, reported along with each benchmark
+ *
+ * Exits with a usage message if the options are invalid.
+ */
+void bench_init(int argc, char **argv, const char *suite);
+
+/*
+ * bench_run - Run a benchmark and report its results
+ * @name: Name of the benchmark
+ * @unit: Unit of the samples, e.g. "ns/op"
+ * @sample: Function measuring one sample
+ * @arg: Argument to pass to @sample
+ */
+void bench_run(const char *name, const char *unit, bench_sample_t sample,
+	       void *arg);
+
+/*
+ * bench_finish - Terminate the output of the benchmark program
+ */
+void bench_finish(void);
+
+/*
+ * bench_now - Read a monotonic clock
+ *
+ * Return: Current time, in nanoseconds
+ */
+uint64_t bench_now(void);
+
+#endif /* _BENCH_H */
@@ -0,0 +1,109 @@
+/*
+ * Channel benchmark
+ *
+ * Measures a producer passing integers to a consumer, through an unbuffered
+ * channel, through buffered channels, and through the pair of semaphores and
+ * value slot that sem_prime.c used before channels, in which every item costs
+ * a round trip between the two threads.
+ *
+ * Usage: bench_chan.x [-w warmup] [-r reps] [-f text|csv|json]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chan.h>
+#include <sem.h>
+#include <uthread.h>
+
+#include "bench.h"
+
+#define ITEMS 100000
+
+static sem_t produce, consume; /* Semaphore-based channel */
+static int slot;
+static volatile int sink;
+
+static void chan_consumer(void *arg)
+{
+	uthread_chan_t chan = arg;
+	int value;
+
+	for (unsigned int i = 0; i < ITEMS; i++) {
+		uthread_chan_recv(chan, &value);
+		sink = value;
+	}
+}
+
+static double chan_sample(void *arg)
+{
+	size_t capacity = (uintptr_t)arg;
+	uthread_chan_t chan = uthread_chan_create(sizeof(int), capacity);
+	uthread_t t;
+	uint64_t start, elapsed;
+
+	if (chan == NULL) {
+		perror("uthread_chan_create");
+		exit(1);
+	}
+
+	start = bench_now();
+	t = uthread_create(chan_consumer, chan);
+	for (int i = 0; i < ITEMS; i++)
+		uthread_chan_send(chan, &i);
+	uthread_join(t, NULL);
+	elapsed = bench_now() - start;
+
+	uthread_chan_destroy(chan);
+	return (double)elapsed / ITEMS;
+}
+
+static void sem_consumer(void *arg)
+{
+	(void)arg;
+	for (unsigned int i = 0; i < ITEMS; i++) {
+		sem_down(consume);
+		sink = slot;
+		sem_up(produce);
+	}
+}
+
+static double sem_sample(void *arg)
+{
+	uthread_t t;
+	uint64_t start;
+
+	(void)arg;
+	start = bench_now();
+	t = uthread_create(sem_consumer, NULL);
+	for (int i = 0; i < ITEMS; i++) {
+		slot = i;
+		sem_up(consume);
+		sem_down(produce);
+	}
+	uthread_join(t, NULL);
+	return (double)(bench_now() - start) / ITEMS;
+}
+
+static void benches(void *arg)
+{
+	(void)arg;
+	bench_run("unbuffered", "ns/item", chan_sample, (void *)0);
+	bench_run("buffered_1", "ns/item", chan_sample, (void *)1);
+	bench_run("buffered_16", "ns/item", chan_sample, (void *)16);
+	bench_run("sem_pair", "ns/item", sem_sample, NULL);
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv, "chan");
+	produce = sem_create(0);
+	consume = sem_create(0);
+	if (uthread_run(false, benches, NULL))
+		return 1;
+	bench_finish();
+	sem_destroy(produce);
+	sem_destroy(consume);
+	return 0;
+}
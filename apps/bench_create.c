@@ -0,0 +1,73 @@
+/*
+ * Thread creation benchmark
+ *
+ * Measures the whole lifetime of threads that do nothing: their creation, their
+ * first switch, their termination and their joining. Threads are created and
+ * joined one at a time, which recycles the same TCB and stack, or by batches,
+ * which makes the TCB and stack allocators work harder.
+ *
+ * Usage: bench_create.x [-w warmup] [-r reps] [-f text|csv|json]
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <uthread.h>
+
+#include "bench.h"
+
+#define THREADS 10000
+#define BATCH 1000
+
+static uthread_t threads[BATCH];
+
+static void nothing(void *arg)
+{
+	(void)arg;
+}
+
+static double one_sample(void *arg)
+{
+	uint64_t start = bench_now();
+
+	(void)arg;
+	for (unsigned int i = 0; i < THREADS; i++)
+		uthread_join(uthread_create(nothing, NULL), NULL);
+	return (double)(bench_now() - start) / THREADS;
+}
+
+static double batch_sample(void *arg)
+{
+	uthread_attr_t attr;
+	uint64_t start;
+
+	uthread_attr_init(&attr);
+	attr.shared_stack = arg != NULL;
+
+	start = bench_now();
+	for (unsigned int n = 0; n < THREADS; n += BATCH) {
+		for (unsigned int i = 0; i < BATCH; i++)
+			threads[i] = uthread_create_attr(&attr, nothing, NULL);
+		for (unsigned int i = 0; i < BATCH; i++)
+			uthread_join(threads[i], NULL);
+	}
+	return (double)(bench_now() - start) / THREADS;
+}
+
+static void benches(void *arg)
+{
+	(void)arg;
+	bench_run("create_join", "ns/op", one_sample, NULL);
+	bench_run("create_join_batch", "ns/op", batch_sample, NULL);
+	bench_run("create_join_shared_stack", "ns/op", batch_sample, (void *)1);
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv, "create");
+	if (uthread_run(false, benches, NULL))
+		return 1;
+	bench_finish();
+	return 0;
+}
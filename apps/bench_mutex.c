@@ -0,0 +1,146 @@
+/*
+ * Mutex benchmark
+ *
+ * Compares uthread_mutex_t to a semaphore used as a lock: taken and released by
+ * a single thread, then by several threads yielding while holding the lock, so
+ * that all the others wait in line for it. Also measures a ping-pong between two
+ * threads through a condition variable, to compare with the semaphore one of
+ * bench_sem.
+ *
+ * Usage: bench_mutex.x [-w warmup] [-r reps] [-f text|csv|json]
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <mutex.h>
+#include <sem.h>
+#include <uthread.h>
+
+#include "bench.h"
+
+#define OPS 1000000
+#define THREADS 8
+#define CONTENDED_OPS 10000
+#define ROUNDS 100000
+
+static uthread_mutex_t mutex;
+static sem_t sem;
+static uthread_cond_t cond;
+static bool turn; /* Whose turn it is in the ping-pong, under mutex */
+
+static double mutex_sample(void *arg)
+{
+	uint64_t start = bench_now();
+
+	(void)arg;
+	for (unsigned int i = 0; i < OPS; i++) {
+		uthread_mutex_lock(mutex);
+		uthread_mutex_unlock(mutex);
+	}
+	return (double)(bench_now() - start) / OPS;
+}
+
+static double sem_sample(void *arg)
+{
+	uint64_t start = bench_now();
+
+	(void)arg;
+	for (unsigned int i = 0; i < OPS; i++) {
+		sem_down(sem);
+		sem_up(sem);
+	}
+	return (double)(bench_now() - start) / OPS;
+}
+
+static void mutex_contender(void *arg)
+{
+	(void)arg;
+	for (unsigned int i = 0; i < CONTENDED_OPS; i++) {
+		uthread_mutex_lock(mutex);
+		uthread_yield();
+		uthread_mutex_unlock(mutex);
+	}
+}
+
+static void sem_contender(void *arg)
+{
+	(void)arg;
+	for (unsigned int i = 0; i < CONTENDED_OPS; i++) {
+		sem_down(sem);
+		uthread_yield();
+		sem_up(sem);
+	}
+}
+
+static double contended_sample(void *arg)
+{
+	uthread_t threads[THREADS];
+	uint64_t start = bench_now();
+
+	for (unsigned int i = 0; i < THREADS; i++)
+		threads[i] = uthread_create(arg, NULL);
+	for (unsigned int i = 0; i < THREADS; i++)
+		uthread_join(threads[i], NULL);
+	return (double)(bench_now() - start) / (THREADS * CONTENDED_OPS);
+}
+
+static void pong(void *arg)
+{
+	(void)arg;
+	uthread_mutex_lock(mutex);
+	for (unsigned int i = 0; i < ROUNDS; i++) {
+		while (!turn)
+			uthread_cond_wait(cond, mutex);
+		turn = false;
+		uthread_cond_signal(cond);
+	}
+	uthread_mutex_unlock(mutex);
+}
+
+static double pingpong_sample(void *arg)
+{
+	uthread_t t;
+	uint64_t start;
+
+	(void)arg;
+	start = bench_now();
+	t = uthread_create(pong, NULL);
+	uthread_mutex_lock(mutex);
+	for (unsigned int i = 0; i < ROUNDS; i++) {
+		turn = true;
+		uthread_cond_signal(cond);
+		while (turn)
+			uthread_cond_wait(cond, mutex);
+	}
+	uthread_mutex_unlock(mutex);
+	uthread_join(t, NULL);
+	return (double)(bench_now() - start) / ROUNDS;
+}
+
+static void benches(void *arg)
+{
+	(void)arg;
+	bench_run("mutex_lock_unlock", "ns/op", mutex_sample, NULL);
+	bench_run("sem_down_up", "ns/op", sem_sample, NULL);
+	bench_run("mutex_contended", "ns/op", contended_sample,
+		  mutex_contender);
+	bench_run("sem_contended", "ns/op", contended_sample, sem_contender);
+	bench_run("cond_pingpong", "ns/round", pingpong_sample, NULL);
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv, "mutex");
+	mutex = uthread_mutex_create();
+	sem = sem_create(1);
+	cond = uthread_cond_create();
+	if (uthread_run(false, benches, NULL))
+		return 1;
+	bench_finish();
+	uthread_cond_destroy(cond);
+	sem_destroy(sem);
+	uthread_mutex_destroy(mutex);
+	return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * Preemption benchmark
+ *
+ * Two threads compute the same amount of work, without preemption, then with a
+ * time slice of 100us, so that the timer keeps switching between them. The
+ * difference between both durations, divided by the number of preemptions (see
+ * uthread_stats_t), is the cost of a preemption, from the timer signal to the
+ * switch back. The overhead is that cost relative to the time slice.
+ *
+ * Usage: bench_preempt.x [-w warmup] [-r reps] [-f text|csv|json]
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <uthread.h>
+
+#include "bench.h"
+
+#define WORK 20000000
+#define SLICE_US 100
+
+static volatile unsigned long sink;
+
+static void worker(void *arg)
+{
+	unsigned long sum = 0;
+
+	(void)arg;
+	for (unsigned long i = 0; i < WORK; i++)
+		sum += i * i;
+	sink = sum;
+}
+
+static void workers(void *arg)
+{
+	uthread_t a = uthread_create(worker, NULL);
+	uthread_t b = uthread_create(worker, NULL);
+
+	(void)arg;
+	uthread_join(a, NULL);
+	uthread_join(b, NULL);
+}
+
+/* Run the work, and return the number of preemptions it took */
+static uint64_t run(bool preempt, uint64_t *ns)
+{
+	uthread_sched_stats_t stats;
+	uint64_t start = bench_now();
+
+	if (uthread_run(preempt, workers, NULL) ||
+	    uthread_sched_stats_get(&stats)) {
+		fprintf(stderr, "uthread_run failed\n");
+		exit(1);
+	}
+	*ns = bench_now() - start;
+	return stats.total.preempted;
+}
+
+static double cost_sample(void *arg)
+{
+	uint64_t off, on, preemptions;
+
+	(void)arg;
+	run(false, &off);
+	preemptions = run(true, &on);
+	if (preemptions == 0)
+		return 0;
+	return ((double)on - off) / preemptions;
+}
+
+static double overhead_sample(void *arg)
+{
+	return cost_sample(arg) / (SLICE_US * 10);
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv, "preempt");
+	uthread_set_timeslice(SLICE_US, UTHREAD_CLOCK_MONOTONIC, false);
+	bench_run("preemption", "ns/op", cost_sample, NULL);
+	bench_run("overhead_100us", "%", overhead_sample, NULL);
+	bench_finish();
+	return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * Queue benchmark
+ *
+ * Measures queue_t on its own, with the backend it is built with (see
+ * libuthread/Makefile): an enqueue followed by a dequeue on an empty queue, a
+ * queue filled up then drained, and the iteration over a full queue.
+ *
+ * Usage: bench_queue.x [-w warmup] [-r reps] [-f text|csv|json]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <queue.h>
+
+#include "bench.h"
+
+#define OPS 1000000
+#define ITEMS 100000
+
+static volatile uintptr_t sink;
+
+static double enqueue_dequeue_sample(void *arg)
+{
+	queue_t q = arg;
+	void *data;
+	uint64_t start = bench_now();
+
+	for (uintptr_t i = 0; i < OPS; i++) {
+		queue_enqueue(q, (void *)i);
+		queue_dequeue(q, &data);
+	}
+	sink = (uintptr_t)data;
+	return (double)(bench_now() - start) / OPS;
+}
+
+static double fill_drain_sample(void *arg)
+{
+	queue_t q = arg;
+	void *data;
+	uint64_t start = bench_now();
+
+	for (uintptr_t i = 0; i < ITEMS; i++)
+		queue_enqueue(q, (void *)i);
+	for (uintptr_t i = 0; i < ITEMS; i++)
+		queue_dequeue(q, &data);
+	sink = (uintptr_t)data;
+	return (double)(bench_now() - start) / (2 * ITEMS);
+}
+
+static void visit(queue_t q, void *data)
+{
+	(void)q;
+	sink += (uintptr_t)data;
+}
+
+static double iterate_sample(void *arg)
+{
+	queue_t q = arg;
+	uint64_t start = bench_now();
+
+	queue_iterate(q, visit);
+	return (double)(bench_now() - start) / ITEMS;
+}
+
+int main(int argc, char **argv)
+{
+	queue_t q = queue_create();
+
+	if (q == NULL) {
+		perror("queue_create");
+		return 1;
+	}
+
+	bench_init(argc, argv, "queue");
+	bench_run("enqueue_dequeue", "ns/op", enqueue_dequeue_sample, q);
+	bench_run("fill_drain", "ns/op", fill_drain_sample, q);
+
+	for (uintptr_t i = 0; i < ITEMS; i++)
+		queue_enqueue(q, (void *)i);
+	bench_run("iterate", "ns/item", iterate_sample, q);
+	while (queue_length(q) > 0)
+		queue_dequeue(q, (void **)&sink);
+	bench_finish();
+
+	queue_destroy(q);
+	return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * Semaphore benchmark
+ *
+ * Measures a semaphore taken and released by a single thread, which never
+ * blocks, a ping-pong between two threads through two semaphores, in which
+ * every round trip blocks and wakes up each thread once, and a producer passing
+ * items to a consumer through a bounded buffer. The last two run with each wake
+ * policy (see sem_wake_t). Finally, a group of threads is released over and
+ * over, either by one sem_up() per thread, or by a single sem_up_n() or
+ * sem_broadcast(), which reschedule once for the whole group.
+ *
+ * Usage: bench_sem.x [-w warmup] [-r reps] [-f text|csv|json]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#include "bench.h"
+
+#define OPS 1000000
+#define ROUNDS 100000
+#define ITEMS 100000
+#define SLOTS 16
+#define GROUP 16
+#define RELEASES 20000
+
+static sem_t ping_sem, pong_sem;
+static sem_t items, slots; /* Filled and empty slots of the buffer */
+static unsigned int buffer[SLOTS];
+static volatile unsigned int sink;
+static sem_t gate, back; /* Release a group of threads, and wait for it */
+
+static const char *const wake_names[] = {
+	[SEM_WAKE_YIELD] = "yield",
+	[SEM_WAKE_CONTINUE] = "continue",
+	[SEM_WAKE_HANDOFF] = "handoff",
+};
+
+static void set_wake(sem_wake_t wake)
+{
+	sem_set_wake(ping_sem, wake);
+	sem_set_wake(pong_sem, wake);
+	sem_set_wake(items, wake);
+	sem_set_wake(slots, wake);
+}
+
+static double uncontended_sample(void *arg)
+{
+	sem_t sem = arg;
+	uint64_t start = bench_now();
+
+	for (unsigned int i = 0; i < OPS; i++) {
+		sem_up(sem);
+		sem_down(sem);
+	}
+	return (double)(bench_now() - start) / OPS;
+}
+
+static void pong(void *arg)
+{
+	(void)arg;
+	for (unsigned int i = 0; i < ROUNDS; i++) {
+		sem_down(pong_sem);
+		sem_up(ping_sem);
+	}
+}
+
+static double pingpong_sample(void *arg)
+{
+	uthread_t t;
+	uint64_t start;
+
+	(void)arg;
+	start = bench_now();
+	t = uthread_create(pong, NULL);
+	for (unsigned int i = 0; i < ROUNDS; i++) {
+		sem_up(pong_sem);
+		sem_down(ping_sem);
+	}
+	uthread_join(t, NULL);
+	return (double)(bench_now() - start) / ROUNDS;
+}
+
+static void consumer(void *arg)
+{
+	(void)arg;
+	for (unsigned int i = 0; i < ITEMS; i++) {
+		sem_down(items);
+		sink = buffer[i % SLOTS];
+		sem_up(slots);
+	}
+}
+
+static double buffer_sample(void *arg)
+{
+	uthread_t t;
+	uint64_t start;
+
+	(void)arg;
+	start = bench_now();
+	t = uthread_create(consumer, NULL);
+	for (unsigned int i = 0; i < ITEMS; i++) {
+		sem_down(slots);
+		buffer[i % SLOTS] = i;
+		sem_up(items);
+	}
+	uthread_join(t, NULL);
+	return (double)(bench_now() - start) / ITEMS;
+}
+
+enum release {
+	RELEASE_UP,
+	RELEASE_UP_N,
+	RELEASE_BROADCAST,
+};
+
+static void member(void *arg)
+{
+	(void)arg;
+	for (unsigned int i = 0; i < RELEASES; i++) {
+		sem_down(gate);
+		sem_up(back);
+	}
+}
+
+static double release_sample(void *arg)
+{
+	enum release release = (enum release)(uintptr_t)arg;
+	uthread_t t[GROUP];
+	uint64_t start;
+
+	start = bench_now();
+	for (unsigned int i = 0; i < GROUP; i++)
+		t[i] = uthread_create(member, NULL);
+	for (unsigned int i = 0; i < RELEASES; i++) {
+		// Let the whole group block first, so that all its members
+		// get released at once
+		sem_down_n(back, i ? GROUP : 0);
+		uthread_yield();
+		switch (release) {
+		case RELEASE_UP:
+			for (unsigned int j = 0; j < GROUP; j++)
+				sem_up(gate);
+			break;
+		case RELEASE_UP_N:
+			sem_up_n(gate, GROUP);
+			break;
+		case RELEASE_BROADCAST:
+			sem_broadcast(gate);
+			break;
+		}
+	}
+	sem_down_n(back, GROUP);
+	for (unsigned int i = 0; i < GROUP; i++)
+		uthread_join(t[i], NULL);
+	return (double)(bench_now() - start) / RELEASES;
+}
+
+static void benches(void *arg)
+{
+	sem_t sem = sem_create(0);
+	char name[32];
+
+	(void)arg;
+	bench_run("up_down", "ns/op", uncontended_sample, sem);
+	for (sem_wake_t wake = SEM_WAKE_YIELD; wake <= SEM_WAKE_HANDOFF;
+	     wake++) {
+		set_wake(wake);
+		snprintf(name, sizeof(name), "pingpong_%s", wake_names[wake]);
+		bench_run(name, "ns/round", pingpong_sample, NULL);
+		snprintf(name, sizeof(name), "buffer_%s", wake_names[wake]);
+		bench_run(name, "ns/item", buffer_sample, NULL);
+	}
+	sem_destroy(sem);
+
+	bench_run("release_up", "ns/group", release_sample,
+		  (void *)(uintptr_t)RELEASE_UP);
+	bench_run("release_up_n", "ns/group", release_sample,
+		  (void *)(uintptr_t)RELEASE_UP_N);
+	bench_run("release_broadcast", "ns/group", release_sample,
+		  (void *)(uintptr_t)RELEASE_BROADCAST);
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv, "sem");
+	ping_sem = sem_create(0);
+	pong_sem = sem_create(0);
+	items = sem_create(0);
+	slots = sem_create(SLOTS);
+	gate = sem_create(0);
+	back = sem_create(0);
+	if (uthread_run(false, benches, NULL))
+		return 1;
+	bench_finish();
+	sem_destroy(ping_sem);
+	sem_destroy(pong_sem);
+	sem_destroy(items);
+	sem_destroy(slots);
+	sem_destroy(gate);
+	sem_destroy(back);
+	return 0;
+}
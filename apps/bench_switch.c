@@ -0,0 +1,74 @@
+/*
+ * Context switch benchmark
+ *
+ * Threads yield to each other in a round robin, which measures a switch from
+ * one thread to the next through the ready queue: between two threads, between
+ * many of them (whose stacks don't all fit in the cache), and between two
+ * threads with a shared stack (see uthread_attr_t), which copy their stacks.
+ *
+ * Usage: bench_switch.x [-w warmup] [-r reps] [-f text|csv|json]
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <uthread.h>
+
+#include "bench.h"
+
+#define SWITCHES 200000
+
+struct yielders {
+	unsigned int threads;
+	bool shared_stack;
+};
+
+static unsigned int yields; /* Yields of each thread */
+
+static void yielder(void *arg)
+{
+	(void)arg;
+	for (unsigned int i = 0; i < yields; i++)
+		uthread_yield();
+}
+
+static double yield_sample(void *arg)
+{
+	struct yielders *y = arg;
+	uthread_t threads[y->threads];
+	uthread_attr_t attr;
+	uint64_t start;
+
+	uthread_attr_init(&attr);
+	attr.shared_stack = y->shared_stack;
+	yields = SWITCHES / y->threads;
+
+	start = bench_now();
+	for (unsigned int i = 0; i < y->threads; i++)
+		threads[i] = uthread_create_attr(&attr, yielder, NULL);
+	for (unsigned int i = 0; i < y->threads; i++)
+		uthread_join(threads[i], NULL);
+	return (double)(bench_now() - start) / (yields * y->threads);
+}
+
+static void benches(void *arg)
+{
+	struct yielders two = { 2, false };
+	struct yielders many = { 256, false };
+	struct yielders shared = { 2, true };
+
+	(void)arg;
+	bench_run("yield_2", "ns/op", yield_sample, &two);
+	bench_run("yield_256", "ns/op", yield_sample, &many);
+	bench_run("yield_2_shared_stack", "ns/op", yield_sample, &shared);
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv, "switch");
+	if (uthread_run(false, benches, NULL))
+		return 1;
+	bench_finish();
+	return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * File I/O benchmark
+ *
+ * Threads read random blocks from a file, first with plain pread(), which
+ * blocks the whole process at every read, then with the io_uring backend (see
+ * uthread_set_io_uring()), which lets the reads of all the threads overlap. The
+ * file is opened with O_DIRECT when the filesystem supports it, so that the
+ * reads actually reach the disk instead of the page cache. The program outputs
+ * the throughput of both:
+ *
+ * sync:  8192 reads in 1.234 s, 6638 reads/s
+ * uring: 8192 reads in 0.123 s, 66601 reads/s
+ *
+ * Usage: io_bench.x [file [threads]], where file is created (and removed) for
+ * the benchmark.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <io.h>
+#include <uthread.h>
+
+#define FILE_SIZE (64 << 20)
+#define BLOCK_SIZE 4096
+#define NREADS 8192
+#define NTHREADS 32
+
+static int fd;
+static unsigned int nthreads = NTHREADS;
+static bool use_uring;
+
+void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+void reader(void *arg)
+{
+	uint32_t seed = (uintptr_t)arg + 1;
+	void *buf;
+
+	if (posix_memalign(&buf, BLOCK_SIZE, BLOCK_SIZE))
+		die("posix_memalign");
+
+	for (unsigned int i = 0; i < NREADS / nthreads; i++) {
+		off_t offset;
+		ssize_t len;
+
+		/* same random blocks in both modes */
+		seed = seed * 1103515245 + 12345;
+		offset = (off_t)(seed % (FILE_SIZE / BLOCK_SIZE)) * BLOCK_SIZE;
+		if (use_uring)
+			len = uthread_pread(fd, buf, BLOCK_SIZE, offset);
+		else
+			len = pread(fd, buf, BLOCK_SIZE, offset);
+		if (len != BLOCK_SIZE)
+			die("pread");
+	}
+	free(buf);
+}
+
+void bench(void *arg)
+{
+	(void)arg;
+
+	for (unsigned int i = 0; i < nthreads; i++)
+		uthread_create(reader, (void *)(uintptr_t)i);
+}
+
+void run(const char *name, bool uring)
+{
+	struct timespec start, end;
+	double secs;
+
+	use_uring = uring;
+	if (uthread_set_io_uring(uring))
+		die("uthread_set_io_uring");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	uthread_run(false, bench, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%-6s %u reads in %.3f s, %.0f reads/s\n", name,
+	       NREADS / nthreads * nthreads, secs,
+	       NREADS / nthreads * nthreads / secs);
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = argc > 1 ? argv[1] : "io_bench.tmp";
+	char *block;
+
+	if (argc > 2)
+		nthreads = atoi(argv[2]);
+	if (nthreads == 0 || nthreads > NREADS) {
+		fprintf(stderr, "invalid number of threads\n");
+		return 1;
+	}
+
+	/* create the file */
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		die("open");
+	block = malloc(BLOCK_SIZE);
+	memset(block, 0xa5, BLOCK_SIZE);
+	for (off_t off = 0; off < FILE_SIZE; off += BLOCK_SIZE)
+		if (pwrite(fd, block, BLOCK_SIZE, off) != BLOCK_SIZE)
+			die("pwrite");
+	free(block);
+	if (fsync(fd))
+		die("fsync");
+	close(fd);
+
+	/* bypass the page cache if possible, or at least empty it */
+	fd = open(path, O_RDONLY | O_DIRECT);
+	if (fd < 0) {
+		fd = open(path, O_RDONLY);
+		if (fd < 0)
+			die("open");
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	}
+	unlink(path);
+
+	run("sync:", false);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	run("uring:", true);
+
+	close(fd);
+	return 0;
+}
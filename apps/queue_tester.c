@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <queue.h>
 #include <string.h>
+#include <sys/resource.h>
 
 /* Test macro*/
 #define TEST_ASSERT(assertion)						\
@@ -169,11 +170,12 @@ static void iterate_func(queue_t queue, void *data) {
 
 /* Iterate function to be used in queue_iterate test */
 static void test_iterate_data(queue_t queue, const char *expected_output) {
-    char buffer[1024];
+    char buffer[1024] = { 0 };
     FILE *temp_stdout = tmpfile();
     assert(temp_stdout != NULL);
     
-    // Redirect stdout to the temporary file
+    // Redirect stdout to the temporary file, without anything still buffered
+    fflush(stdout);
     int saved_stdout = dup(fileno(stdout));
     dup2(fileno(temp_stdout), fileno(stdout));
 
@@ -208,6 +210,139 @@ void test_queue_iteration() {
     test_iterate_data(queue, "0 1 2 ");
 }
 
+/* Test queue created with a capacity hint */
+void test_queue_create_with_capacity(void)
+{
+	int items[100];
+	int *ptr;
+	int ok = 1;
+	queue_t queue = queue_create_with_capacity(4);
+
+	fprintf(stderr, "*** TEST queue create with capacity ***\n");
+
+	/* Go past the hint, and make the oldest item wrap around */
+	for (int i = 0; i < 100; i++) {
+		items[i] = i;
+		queue_enqueue(queue, &items[i]);
+		if (i % 3 == 0) {
+			queue_dequeue(queue, (void**)&ptr);
+		}
+	}
+	for (int i = 34; i < 100; i++) {
+		queue_dequeue(queue, (void**)&ptr);
+		ok = ok && ptr == &items[i];
+	}
+
+	TEST_ASSERT(ok && queue_length(queue) == 0);
+}
+
+/* Test order of items around a deletion */
+void test_delete_order(void)
+{
+	int items[6] = {0, 1, 2, 3, 4, 5};
+	int *ptr;
+	int ok = 1;
+	queue_t queue = queue_create();
+
+	fprintf(stderr, "*** TEST delete order ***\n");
+
+	for (int i = 0; i < 6; i++) {
+		queue_enqueue(queue, &items[i]);
+	}
+	queue_delete(queue, &items[1]);
+	queue_delete(queue, &items[4]);
+
+	for (int i = 0; i < 6; i++) {
+		if (i == 1 || i == 4)
+			continue;
+		queue_dequeue(queue, (void**)&ptr);
+		ok = ok && ptr == &items[i];
+	}
+	TEST_ASSERT(ok && queue_length(queue) == 0);
+}
+
+/* Callback deleting odd items while being iterated on */
+static void delete_odd_func(queue_t queue, void *data) {
+	if (*(int *)data % 2)
+		queue_delete(queue, data);
+}
+
+/* Test deletion of items as part of the iteration */
+void test_iterate_delete(void)
+{
+	queue_t queue = queue_create();
+	int items[5] = {0, 1, 2, 3, 4};
+
+	for (int i = 0; i < 5; i++) {
+		queue_enqueue(queue, &items[i]);
+	}
+
+	fprintf(stderr, "*** TEST queue iteration with deletion ***\n");
+	queue_iterate(queue, delete_odd_func);
+	test_iterate_data(queue, "0 2 4 ");
+}
+
+/* Test deletion by handle */
+void test_delete_handle(void)
+{
+	int items[5] = {0, 1, 2, 3, 4};
+	queue_node_t handles[5];
+	int *ptr;
+	queue_t queue = queue_create();
+
+	fprintf(stderr, "*** TEST delete handle ***\n");
+
+	for (int i = 0; i < 5; i++) {
+		queue_enqueue_handle(queue, &items[i], &handles[i]);
+	}
+	queue_delete_handle(queue, handles[3]);
+	queue_delete_handle(queue, handles[0]);
+	queue_dequeue(queue, (void**)&ptr);
+
+	TEST_ASSERT(ptr == &items[1] && queue_length(queue) == 2);
+	test_iterate_data(queue, "2 4 ");
+}
+
+/* Test deletion by handle of many short-lived items among long-lived ones */
+void test_delete_handle_churn(void)
+{
+	int items[100], item;
+	queue_node_t handles[100], handle;
+	int *ptr;
+	int ok = 1;
+	struct rusage before, after;
+	queue_t queue = queue_create();
+
+	fprintf(stderr, "*** TEST delete handle churn ***\n");
+
+	getrusage(RUSAGE_SELF, &before);
+
+	/* Every 10000 items, one stays in the queue */
+	for (int i = 0; i < 1000000; i++) {
+		if (i % 10000 == 0) {
+			items[i / 10000] = i / 10000;
+			queue_enqueue_handle(queue, &items[i / 10000],
+					     &handles[i / 10000]);
+		}
+		queue_enqueue_handle(queue, &item, &handle);
+		ok = ok && queue_delete_handle(queue, handle) == 0;
+	}
+	ok = ok && queue_delete(queue, &item) == -1;
+
+	/* Deleted items don't pile up in the queue */
+	getrusage(RUSAGE_SELF, &after);
+	TEST_ASSERT(after.ru_maxrss - before.ru_maxrss < 4096);
+
+	/* Handles of the items left are still valid */
+	for (int i = 1; i < 100; i += 2) {
+		ok = ok && queue_delete_handle(queue, handles[i]) == 0;
+	}
+	for (int i = 0; i < 100; i += 2) {
+		ok = ok && queue_dequeue(queue, (void**)&ptr) == 0 &&
+		     ptr == &items[i];
+	}
+	TEST_ASSERT(ok && queue_length(queue) == 0);
+}
 
 int main(void)
 {
@@ -222,5 +357,10 @@ int main(void)
 	test_dequeue_empty_queue();
 	test_dequeue_string_array();
 	test_queue_iteration();
+	test_queue_create_with_capacity();
+	test_delete_order();
+	test_iterate_delete();
+	test_delete_handle();
+	test_delete_handle_churn();
 	return 0;
 }
\ No newline at end of file
@@ -4,11 +4,17 @@
  * A producer produces x values in a shared buffer, while a consume consumes y
  * of these values. x and y are always less than the size of the buffer but can
  * be different. The synchronization is managed through two semaphores.
+ *
+ * Usage: sem_buffer.x [maxcount] [consumer seed] [producer seed] [wake], where
+ * wake is the wake policy of the two semaphores: yield, continue (default), or
+ * handoff (see sem_wake_t). With continue, the producer fills the buffer before
+ * the consumer empties it, instead of switching to it at every item.
  */
 
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <sem.h>
 #include <uthread.h>
@@ -85,10 +91,23 @@ static unsigned int get_argv(char *argv)
 	return ret;
 }
 
+static sem_wake_t get_wake(char *argv)
+{
+	if (!strcmp(argv, "yield"))
+		return SEM_WAKE_YIELD;
+	if (!strcmp(argv, "continue"))
+		return SEM_WAKE_CONTINUE;
+	if (!strcmp(argv, "handoff"))
+		return SEM_WAKE_HANDOFF;
+	fprintf(stderr, "Invalid wake policy: %s\n", argv);
+	exit(1);
+}
+
 int main(int argc, char **argv)
 {
 	struct test4 t;
 	unsigned int maxcount = MAXCOUNT;
+	sem_wake_t wake = SEM_WAKE_CONTINUE;
 
 	t.cons_seed = 1;
 	t.prod_seed = 2;
@@ -99,6 +118,8 @@ int main(int argc, char **argv)
 		t.cons_seed = get_argv(argv[2]);
 	if (argc > 3)
 		t.prod_seed = get_argv(argv[3]);
+	if (argc > 4)
+		wake = get_wake(argv[4]);
 
 	t.size = t.head = t.tail = 0;
 	t.maxcount = maxcount;
@@ -106,6 +127,8 @@ int main(int argc, char **argv)
 	t.mutex = sem_create(1);
 	t.empty = sem_create(0);
 	t.full = sem_create(BUFFER_SIZE);
+	sem_set_wake(t.empty, wake);
+	sem_set_wake(t.full, wake);
 
 	uthread_run(false, producer, &t);
 
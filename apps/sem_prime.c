@@ -5,7 +5,12 @@
  * a consumer thread (sink) gets prime numbers from the end of the pipeline. The
  * pipeline consists of filtering thread, added dynamically each time a new
  * prime number is found and which filters out subsequent numbers that are
- * multiples of that prime.
+ * multiples of that prime. The stages are connected by channels.
+ *
+ * Usage: sem_prime.x [max [workers [capacity]]], where workers is the number of
+ * kernel threads running the pipeline (see uthread_set_workers()), and capacity
+ * the number of numbers each channel can hold, 0 (the default) for unbuffered
+ * channels.
  */
 
 #include <limits.h>
@@ -13,42 +18,47 @@
 #include <stdlib.h>
 #include <unistd.h>
 
-#include <sem.h>
+#include <chan.h>
 #include <uthread.h>
 
 #define MAXPRIME 1000
 
-struct channel {
-	int value;
-	sem_t produce;
-	sem_t consume;
-};
-
 struct filter {
-	struct channel *left;
-	struct channel *right;
+	uthread_chan_t left;
+	uthread_chan_t right;
 	unsigned int prime;
 	struct filter *next;
 };
 
 static unsigned int max = MAXPRIME;
+static unsigned int capacity;
+
+static uthread_chan_t chan_create(void)
+{
+	uthread_chan_t c = uthread_chan_create(sizeof(int), capacity);
+
+	if (c == NULL) {
+		perror("uthread_chan_create");
+		exit(1);
+	}
+	return c;
+}
 
 /* Producer thread: produces all numbers, from 2 to max */
 static void source(void *arg)
 {
-	struct channel *c = (struct channel*) arg;
+	uthread_chan_t c = arg;
+	int value;
 	size_t i;
 
 	for (i = 2; i <= max; i++) {
-		c->value = i;
-		sem_up(c->consume);
-		sem_down(c->produce);
+		value = i;
+		uthread_chan_send(c, &value);
 	}
 
-	/* mark completion */
-	c->value = -1;
-	sem_up(c->consume);
-	sem_down(c->produce);
+	/* mark completion; the channel is destroyed by its consumer */
+	value = -1;
+	uthread_chan_send(c, &value);
 }
 
 /* Filter thread */
@@ -58,46 +68,34 @@ static void filter(void *arg)
 	int value;
 
 	while (1) {
-		sem_down(f->left->consume);
-		value = f->left->value;
-		sem_up(f->left->produce);
-		if ((value == -1) || (value % f->prime != 0)) {
-			f->right->value = value;
-			sem_up(f->right->consume);
-			sem_down(f->right->produce);
-		}
+		uthread_chan_recv(f->left, &value);
+		if ((value == -1) || (value % f->prime != 0))
+			uthread_chan_send(f->right, &value);
 		if (value == -1)
 			break;
 	}
 
-	sem_destroy(f->left->produce);
-	sem_destroy(f->left->consume);
-	free(f->left);
+	/* nothing can be sent anymore to the channel we consume */
+	uthread_chan_destroy(f->left);
 	free(f);
 }
 
 /* Consumer thread */
 static void sink(void *arg)
 {
-	struct channel *init_p, *p;
+	uthread_chan_t p;
 	int value;
 	struct filter *f_head = NULL;
 	(void)arg;
 
-	init_p = malloc(sizeof(*init_p));
-
-	p = init_p;
-	p->produce = sem_create(0);
-	p->consume = sem_create(0);
+	p = chan_create();
 
 	uthread_create(source, p);
 
 	while (1) {
 		struct filter *f;
 
-		sem_down(p->consume);
-		value = p->value;
-		sem_up(p->produce);
+		uthread_chan_recv(p, &value);
 
 		if (value == -1)
 			break;
@@ -109,22 +107,19 @@ static void sink(void *arg)
 		f->prime = value;
 		f->next = NULL;
 
-		p = malloc(sizeof(*p));
-		p->produce = sem_create(0);
-		p->consume = sem_create(0);
+		p = chan_create();
 
 		f->right = p;
 
-		uthread_create(filter, f);
-
 		if (f_head)
 			f->next = f_head;
 		f_head = f;
+
+		/* with several workers, the filter may run (and free f) right away */
+		uthread_create(filter, f);
 	}
 
-	sem_destroy(p->produce);
-	sem_destroy(p->consume);
-	free(p);
+	uthread_chan_destroy(p);
 }
 
 static unsigned int get_argv(char *argv)
@@ -142,6 +137,12 @@ int main(int argc, char **argv)
 {
 	if (argc > 1)
 		max = get_argv(argv[1]);
+	if (argc > 2 && uthread_set_workers(get_argv(argv[2]))) {
+		fprintf(stderr, "invalid number of workers\n");
+		return 1;
+	}
+	if (argc > 3)
+		capacity = get_argv(argv[3]);
 
 	uthread_run(false, sink, NULL);
 
@@ -0,0 +1,66 @@
+/*
+ * Semaphore timeout test
+ *
+ * A pool of SLOTS handlers serves REQUESTS requests arriving at once, each
+ * taking HOLD_MS to handle. Requests that can't get a handler within WAIT_MS
+ * are shed instead of piling up, and a last one, which can't wait at all, is
+ * only served once the pool is idle again.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define SLOTS 2
+#define REQUESTS 6
+#define WAIT_MS 5
+#define HOLD_MS 20
+
+static sem_t pool;
+
+static void request(void *arg)
+{
+	unsigned long id = (unsigned long)arg;
+
+	if (sem_timeddown(pool, WAIT_MS * 1000000ULL) == ETIMEDOUT) {
+		printf("request %lu: shed after %d ms\n", id, WAIT_MS);
+		return;
+	}
+	uthread_sleep_ns(HOLD_MS * 1000000ULL);
+	printf("request %lu: served\n", id);
+	sem_up(pool);
+}
+
+static void frontend(void *arg)
+{
+	uthread_t requests[REQUESTS];
+
+	(void)arg;
+	for (unsigned long i = 0; i < REQUESTS; i++)
+		requests[i] = uthread_create(request, (void *)i);
+	uthread_yield();
+
+	/* All the handlers are busy */
+	if (sem_trydown(pool))
+		printf("late request: rejected\n");
+
+	for (unsigned int i = 0; i < REQUESTS; i++)
+		uthread_join(requests[i], NULL);
+
+	if (sem_trydown(pool) == 0) {
+		printf("late request: served\n");
+		sem_up(pool);
+	}
+}
+
+int main(void)
+{
+	pool = sem_create(SLOTS);
+	uthread_run(false, frontend, NULL);
+	sem_destroy(pool);
+
+	return 0;
+}
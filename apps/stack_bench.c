@@ -0,0 +1,193 @@
+/*
+ * Shared stack benchmark
+ *
+ * Compares threads with stacks of their own to threads with a shared stack (see
+ * uthread_attr_t), for various amounts of stack in use by each thread. For every
+ * depth (bytes of stack the threads hold when switched out), the program
+ * outputs the cost of a switch, measured with threads yielding to each other,
+ * and the memory used by each thread, measured with threads all blocked at once:
+ *
+ * depth  own ns/switch  shared ns/switch  own KiB/thread  shared KiB/thread
+ *   256             72               102            4.31               0.77
+ *  1024             68               142            3.97               1.50
+ *  4096             79               386            7.97               4.50
+ * 16384             76              1036           19.96              16.50
+ *
+ * Switches between threads with a shared stack copy the stack in use twice, so
+ * they get slower with the depth, whereas threads with stacks of their own use
+ * at least a whole page of stack. Shared stacks pay off for many mostly blocked
+ * threads holding a few KiB of stack at most: past a page, they save little
+ * memory for much slower switches.
+ *
+ * Usage: stack_bench.x [threads], the number of threads blocked at once for
+ * the memory measurements.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define NTHREADS 10000
+#define NYIELDERS 64
+#define NYIELDS 2000
+
+static const size_t depths[] = { 256, 1024, 4096, 16384 };
+
+static unsigned int nthreads = NTHREADS;
+static bool shared;
+static size_t depth;
+static sem_t blocked; /* Threads waiting to be released */
+static sem_t parked; /* Signaled by the threads once blocked */
+
+void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Resident memory of the process, in KiB */
+long rss(void)
+{
+	long pages = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+
+	if (f == NULL || fscanf(f, "%*d %ld", &pages) != 1)
+		die("statm");
+	fclose(f);
+	return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/* Run @wait while holding @depth bytes of stack */
+void hold(void (*wait)(void))
+{
+	volatile char frame[depth];
+
+	memset((char *)frame, 1, depth);
+	wait();
+	if (frame[0] != 1 || frame[depth - 1] != 1)
+		die("stack corrupted");
+}
+
+void yield_loop(void)
+{
+	for (unsigned int i = 0; i < NYIELDS; i++)
+		uthread_yield();
+}
+
+void block(void)
+{
+	sem_up(parked);
+	sem_down(blocked);
+}
+
+void yielder(void *arg)
+{
+	(void)arg;
+	hold(yield_loop);
+}
+
+void blocker(void *arg)
+{
+	(void)arg;
+	hold(block);
+}
+
+uthread_t spawn(uthread_func_t func)
+{
+	uthread_attr_t attr;
+	uthread_t t;
+
+	uthread_attr_init(&attr);
+	attr.shared_stack = shared;
+	t = uthread_create_attr(&attr, func, NULL);
+	if (t == NULL)
+		die("uthread_create_attr");
+	return t;
+}
+
+/* Nanoseconds per switch between threads that keep yielding */
+double bench_switch(void)
+{
+	uthread_t threads[NYIELDERS];
+	double start = now();
+
+	for (unsigned int i = 0; i < NYIELDERS; i++)
+		threads[i] = spawn(yielder);
+	for (unsigned int i = 0; i < NYIELDERS; i++)
+		uthread_join(threads[i], NULL);
+	return (now() - start) * 1e9 / (NYIELDERS * NYIELDS);
+}
+
+/* KiB per thread, with all of them blocked */
+double bench_memory(void)
+{
+	uthread_t *threads = malloc(nthreads * sizeof(*threads));
+	long before = rss(), after;
+
+	if (threads == NULL)
+		die("malloc");
+	for (unsigned int i = 0; i < nthreads; i++)
+		threads[i] = spawn(blocker);
+	for (unsigned int i = 0; i < nthreads; i++)
+		sem_down(parked);
+	after = rss();
+
+	for (unsigned int i = 0; i < nthreads; i++)
+		sem_up(blocked);
+	for (unsigned int i = 0; i < nthreads; i++)
+		uthread_join(threads[i], NULL);
+	free(threads);
+	return (double)(after - before) / nthreads;
+}
+
+void bench(void *arg)
+{
+	double ns[2], kib[2];
+	(void)arg;
+
+	printf("depth  own ns/switch  shared ns/switch  own KiB/thread  shared KiB/thread\n");
+	for (size_t i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+		depth = depths[i];
+		for (int mode = 0; mode < 2; mode++) {
+			shared = mode;
+			ns[mode] = bench_switch();
+			kib[mode] = bench_memory();
+		}
+		printf("%5zu  %13.0f  %16.0f  %14.2f  %17.2f\n", depth, ns[0],
+		       ns[1], kib[0], kib[1]);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		nthreads = atoi(argv[1]);
+	if (nthreads == 0) {
+		fprintf(stderr, "invalid number of threads\n");
+		return 1;
+	}
+
+	blocked = sem_create(0);
+	parked = sem_create(0);
+	if (uthread_run(false, bench, NULL))
+		die("uthread_run");
+	sem_destroy(blocked);
+	sem_destroy(parked);
+
+	return 0;
+}
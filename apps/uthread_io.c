@@ -0,0 +1,159 @@
+/*
+ * Non-blocking I/O test
+ *
+ * A server thread accepts connections on a loopback TCP socket and starts an
+ * echo thread for each of them. Client threads connect, send a message and wait
+ * for it to come back, while a thread waiting on an empty pipe shows that
+ * blocking on I/O only blocks the calling thread. The program should output:
+ *
+ * client 0: hello 0
+ * client 1: hello 1
+ * client 2: hello 2
+ * client 3: hello 3
+ * pipe: done
+ *
+ * Usage: uthread_io.x [workers [uring]], where uring selects the io_uring
+ * backend (see uthread_set_io_uring()).
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <io.h>
+#include <uthread.h>
+
+#define NCLIENTS 4
+
+static struct sockaddr_in server_addr;
+static int pipefd[2];
+
+void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+void echo(void *arg)
+{
+	int fd = (intptr_t)arg;
+	char buf[64];
+	ssize_t len;
+
+	while ((len = uthread_read(fd, buf, sizeof(buf))) > 0)
+		if (uthread_write(fd, buf, len) != len)
+			die("uthread_write");
+	close(fd);
+}
+
+void server(void *arg)
+{
+	int sockfd = (intptr_t)arg;
+
+	for (int i = 0; i < NCLIENTS; i++) {
+		int fd = uthread_accept(sockfd, NULL, NULL);
+
+		if (fd < 0)
+			die("uthread_accept");
+		uthread_detach(uthread_create(echo, (void *)(intptr_t)fd));
+	}
+	close(sockfd);
+}
+
+void client(void *arg)
+{
+	char msg[64], buf[64];
+	ssize_t len;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&server_addr,
+			      sizeof(server_addr)))
+		die("connect");
+
+	len = snprintf(msg, sizeof(msg), "hello %d", (int)(intptr_t)arg);
+	if (uthread_write(fd, msg, len) != len)
+		die("uthread_write");
+	len = uthread_read(fd, buf, sizeof(buf));
+	if (len != (ssize_t)strlen(msg) || memcmp(buf, msg, len))
+		die("uthread_read");
+	close(fd);
+	uthread_exit(strdup(msg));
+}
+
+void reader(void *arg)
+{
+	char buf[16];
+	ssize_t len;
+
+	(void)arg;
+
+	len = uthread_read(pipefd[0], buf, sizeof(buf) - 1);
+	if (len < 0)
+		die("uthread_read");
+	buf[len] = '\0';
+	printf("pipe: %s\n", buf);
+}
+
+void thread1(void *arg)
+{
+	uthread_t tids[NCLIENTS], pipe_tid;
+	socklen_t addrlen = sizeof(server_addr);
+	int sockfd;
+
+	(void)arg;
+
+	/* listen on an ephemeral port of the loopback interface */
+	sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (sockfd < 0 ||
+	    bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) ||
+	    listen(sockfd, NCLIENTS) ||
+	    getsockname(sockfd, (struct sockaddr *)&server_addr, &addrlen))
+		die("listen");
+
+	if (pipe(pipefd))
+		die("pipe");
+	pipe_tid = uthread_create(reader, NULL);
+
+	uthread_detach(uthread_create(server, (void *)(intptr_t)sockfd));
+	for (int i = 0; i < NCLIENTS; i++)
+		tids[i] = uthread_create(client, (void *)(intptr_t)i);
+
+	for (int i = 0; i < NCLIENTS; i++) {
+		void *msg;
+
+		uthread_join(tids[i], &msg);
+		printf("client %d: %s\n", i, (char *)msg);
+		free(msg);
+	}
+
+	/* the reader has been waiting all along */
+	if (write(pipefd[1], "done", 4) != 4)
+		die("write");
+	uthread_join(pipe_tid, NULL);
+	close(pipefd[0]);
+	close(pipefd[1]);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && uthread_set_workers(atoi(argv[1]))) {
+		fprintf(stderr, "invalid number of workers\n");
+		return 1;
+	}
+	if (argc > 2 && uthread_set_io_uring(true)) {
+		perror("uthread_set_io_uring");
+		return 1;
+	}
+
+	uthread_run(false, thread1, NULL);
+	return 0;
+}
@@ -0,0 +1,74 @@
+/*
+ * Join test
+ *
+ * Tests that a thread can wait for other threads to terminate and get their
+ * exit values. The first thread creates a few threads, each computing the sum
+ * of the integers up to a given bound, and joins them in order: some of them
+ * terminate before being joined, the others after. A detached thread runs
+ * alongside. The program should output:
+ *
+ * sum(0) = 0
+ * sum(10) = 55
+ * detached
+ * sum(100) = 5050
+ * sum(1000) = 500500
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <uthread.h>
+
+#define NTHREADS 4
+
+void sum(void *arg)
+{
+	uintptr_t bound = (uintptr_t)arg;
+	uintptr_t total = 0;
+
+	for (uintptr_t i = 1; i <= bound; i++) {
+		total += i;
+		/* let the bigger sums terminate after being joined */
+		if (i % 100 == 0)
+			uthread_yield();
+	}
+	uthread_exit((void *)total);
+}
+
+void detached(void *arg)
+{
+	(void)arg;
+
+	uthread_yield();
+	printf("detached\n");
+}
+
+void thread1(void *arg)
+{
+	uthread_t tids[NTHREADS];
+	uintptr_t bound = 0;
+	void *total;
+
+	(void)arg;
+
+	for (int i = 0; i < NTHREADS; i++) {
+		tids[i] = uthread_create(sum, (void *)bound);
+		bound = bound ? bound * 10 : 10;
+	}
+	uthread_detach(uthread_create(detached, NULL));
+
+	bound = 0;
+	for (int i = 0; i < NTHREADS; i++) {
+		uthread_join(tids[i], &total);
+		printf("sum(%lu) = %lu\n", (unsigned long)bound,
+		       (unsigned long)(uintptr_t)total);
+		bound = bound ? bound * 10 : 10;
+	}
+}
+
+int main(void)
+{
+	uthread_run(false, thread1, NULL);
+	return 0;
+}
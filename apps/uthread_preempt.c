@@ -0,0 +1,44 @@
+/*
+ * Preemption test
+ *
+ * Tests that a thread that never yields still gets preempted. The first thread
+ * creates a second thread and then spins until the second thread, which can
+ * only run if the first one is forcefully descheduled, sets a flag. The time
+ * slice is 1 ms of wall-clock time. The program should output:
+ *
+ * thread2
+ * thread1
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <uthread.h>
+
+static volatile bool done;
+
+void thread2(void *arg)
+{
+	(void)arg;
+
+	printf("thread2\n");
+	done = true;
+}
+
+void thread1(void *arg)
+{
+	(void)arg;
+
+	uthread_create(thread2, NULL);
+	while (!done)
+		;
+	printf("thread1\n");
+}
+
+int main(void)
+{
+	uthread_set_timeslice(1000, UTHREAD_CLOCK_MONOTONIC, true);
+	uthread_run(true, thread1, NULL);
+	return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * Priority test
+ *
+ * Tests that ready threads run by order of priority. The first thread creates a
+ * second thread and lowers its own priority, which lets the second thread run.
+ * The second thread creates a third thread and lowers its priority below the
+ * first thread's. The third thread, still at the highest priority, runs first,
+ * then the first thread, then the second one. The program should output:
+ *
+ * thread3
+ * thread1
+ * thread2
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <uthread.h>
+
+void thread3(void *arg)
+{
+	(void)arg;
+
+	printf("thread3\n");
+}
+
+void thread2(void *arg)
+{
+	(void)arg;
+
+	uthread_create(thread3, NULL);
+	uthread_set_priority(2);
+	printf("thread2\n");
+}
+
+void thread1(void *arg)
+{
+	(void)arg;
+
+	uthread_create(thread2, NULL);
+	uthread_set_priority(1);
+	printf("thread1\n");
+}
+
+int main(void)
+{
+	uthread_set_mlfq(3, NULL, 0);
+	uthread_run(false, thread1, NULL);
+	return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Sleep test
+ *
+ * Threads sleeping for different durations wake up in the order of their
+ * deadlines, regardless of the order in which they went to sleep, and a
+ * periodic thread ticks at fixed deadlines meanwhile. The program should
+ * output:
+ *
+ * tick 1
+ * 10 ms
+ * tick 2
+ * 20 ms
+ * tick 3
+ * 30 ms
+ * tick 4
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <uthread.h>
+
+#define MS 1000000ULL
+
+uint64_t start;
+
+uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void sleeper(void *arg)
+{
+	uintptr_t ms = (uintptr_t)arg;
+
+	uthread_sleep_ns(ms * MS);
+	printf("%lu ms\n", (unsigned long)ms);
+}
+
+void ticker(void *arg)
+{
+	(void)arg;
+
+	/* deadlines halfway between the sleepers' */
+	for (int i = 1; i <= 4; i++) {
+		uthread_sleep_until(start + (10 * i - 5) * MS);
+		printf("tick %d\n", i);
+	}
+}
+
+void thread1(void *arg)
+{
+	(void)arg;
+
+	start = now();
+	uthread_create(sleeper, (void *)30);
+	uthread_create(sleeper, (void *)10);
+	uthread_create(ticker, NULL);
+	uthread_create(sleeper, (void *)20);
+}
+
+int main(void)
+{
+	uthread_run(false, thread1, NULL);
+	return 0;
+}
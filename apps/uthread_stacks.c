@@ -0,0 +1,87 @@
+/*
+ * Stack mapping test
+ *
+ * Tests that the stacks of the threads, along with their guard pages, are all
+ * unmapped when the scheduler stops. The program runs the scheduler with a few
+ * workers several times in a row, each time creating many threads that yield a
+ * bit, so that they migrate between workers and get freed by workers other than
+ * the ones that allocated them, and counts the mappings of the process after
+ * each run. The first worker, which is the main thread, keeps its cache of
+ * stacks from one run to the next, so the count may vary by that much, but it
+ * shouldn't grow. The program should output:
+ *
+ * mappings flat
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <uthread.h>
+
+#define NWORKERS 4
+#define NTHREADS 1000
+#define NRUNS 8
+#define NCACHED 16
+
+static int count_mappings(void)
+{
+	FILE *maps = fopen("/proc/self/maps", "r");
+	int count = 0;
+	int c;
+
+	if (maps == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+	while ((c = fgetc(maps)) != EOF)
+		count += c == '\n';
+	fclose(maps);
+	return count;
+}
+
+static void yielder(void *arg)
+{
+	(void)arg;
+	for (unsigned int i = 0; i < 10; i++)
+		uthread_yield();
+}
+
+static void spawner(void *arg)
+{
+	static uthread_t tids[NTHREADS];
+
+	(void)arg;
+	for (unsigned int i = 0; i < NTHREADS; i++)
+		tids[i] = uthread_create(yielder, NULL);
+	for (unsigned int i = 0; i < NTHREADS; i++)
+		uthread_join(tids[i], NULL);
+}
+
+int main(void)
+{
+	int first = 0;
+
+	uthread_set_workers(NWORKERS);
+	uthread_set_stack_cache(NCACHED);
+	for (unsigned int run = 0; run < NRUNS; run++) {
+		int count;
+
+		if (uthread_run(false, spawner, NULL)) {
+			fprintf(stderr, "uthread_run failed\n");
+			return 1;
+		}
+
+		/* A cached stack is two mappings, with its guard page */
+		count = count_mappings();
+		if (run == 0) {
+			first = count;
+		} else if (count > first + 2 * NCACHED) {
+			printf("mappings grew from %d to %d after %u runs\n",
+			       first, count, run + 1);
+			return 1;
+		}
+	}
+
+	printf("mappings flat\n");
+	return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * Thread statistics test
+ *
+ * Four threads with different behaviors run for a while: one computes without
+ * ever yielding, one sleeps most of the time, and two hand a semaphore back and
+ * forth. The main thread then prints their statistics, and once uthread_run()
+ * returns, the statistics of the scheduler:
+ *
+ * thread      run ms  ready ms  blocked ms  voluntary  preempted  sem waits
+ * compute      100.1       0.1         0.0          0         10          0
+ * sleep          0.0      10.0        90.1          5          0          0
+ * ping           0.4     100.4         0.2       1000          0       1000
+ * pong           0.5     100.5         0.0       1000          0          0
+ * total        101.1     211.0       290.5       2006         10       1000
+ * idle 99.2 ms
+ *
+ * The compute thread is only switched out by preemptions and spends its time
+ * running, whereas the sleep thread is mostly blocked. The ping thread blocks
+ * on the semaphore at every round, and the pong thread, which always finds it
+ * posted already, yields to ping when posting back. Times vary from run to run.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define ROUNDS 1000
+
+static sem_t ping_sem, pong_sem;
+
+static void compute(void *arg)
+{
+	volatile unsigned long sum = 0;
+	struct timespec start, now;
+
+	(void)arg;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		for (unsigned int i = 0; i < 100000; i++)
+			sum += i;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ((now.tv_sec - start.tv_sec) * 1000 +
+		 (now.tv_nsec - start.tv_nsec) / 1000000 < 100);
+}
+
+static void sleep_thread(void *arg)
+{
+	(void)arg;
+	for (int i = 0; i < 5; i++)
+		uthread_sleep_ns(10 * 1000000);
+}
+
+static void ping(void *arg)
+{
+	(void)arg;
+	for (int i = 0; i < ROUNDS; i++) {
+		sem_up(pong_sem);
+		sem_down(ping_sem);
+	}
+}
+
+static void pong(void *arg)
+{
+	(void)arg;
+	for (int i = 0; i < ROUNDS; i++) {
+		sem_down(pong_sem);
+		sem_up(ping_sem);
+	}
+}
+
+static void print_stats(const char *name, const uthread_stats_t *stats)
+{
+	printf("%-10s %7.1f %9.1f %11.1f %10llu %10llu %10llu\n", name,
+	       stats->run_ns / 1e6, stats->ready_ns / 1e6,
+	       stats->blocked_ns / 1e6, (unsigned long long)stats->voluntary,
+	       (unsigned long long)stats->preempted,
+	       (unsigned long long)stats->sem_waits);
+}
+
+static void print_thread(uthread_t uthread, const uthread_stats_t *stats,
+			 void *arg)
+{
+	(void)arg;
+	/* The main thread is the only one without a name */
+	if (uthread_get_name(uthread)[0] != '\0')
+		print_stats(uthread_get_name(uthread), stats);
+}
+
+static void thread(void *arg)
+{
+	static const struct {
+		const char *name;
+		uthread_func_t func;
+	} threads[] = {
+		{ "compute", compute },
+		{ "sleep", sleep_thread },
+		{ "ping", ping },
+		{ "pong", pong },
+	};
+	uthread_t handles[4];
+	uthread_attr_t attr;
+
+	(void)arg;
+	uthread_attr_init(&attr);
+	for (int i = 0; i < 4; i++) {
+		attr.name = threads[i].name;
+		handles[i] = uthread_create_attr(&attr, threads[i].func, NULL);
+	}
+
+	/* Let them all terminate, but keep them around until joined */
+	uthread_sleep_ns(200 * 1000000);
+	printf("thread      run ms  ready ms  blocked ms  voluntary  preempted  sem waits\n");
+	uthread_stats_foreach(print_thread, NULL);
+	for (int i = 0; i < 4; i++)
+		uthread_join(handles[i], NULL);
+}
+
+int main(void)
+{
+	uthread_sched_stats_t stats;
+
+	ping_sem = sem_create(0);
+	pong_sem = sem_create(0);
+
+	uthread_set_stats(true);
+	uthread_set_timeslice(10000, UTHREAD_CLOCK_MONOTONIC, false);
+	uthread_run(true, thread, NULL);
+
+	uthread_sched_stats_get(&stats);
+	print_stats("total", &stats.total);
+	printf("idle %.1f ms\n", stats.idle_ns / 1e6);
+
+	sem_destroy(ping_sem);
+	sem_destroy(pong_sem);
+
+	return 0;
+}
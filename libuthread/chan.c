@@ -0,0 +1,147 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chan.h"
+#include "private.h"
+#include "uthread.h"
+
+struct uthread_chan {
+	spinlock_t lock; // Protects the rest
+	size_t elem_size; // Size of the elements
+	size_t capacity; // Number of elements buf can hold, 0 if unbuffered
+	size_t head; // Index of the oldest element in buf
+	size_t count; // Number of elements in buf
+	struct list_head senders; // Threads blocked sending, oldest first
+	struct list_head receivers; // Threads blocked receiving, oldest first
+	unsigned char buf[]; // Ring buffer of the elements
+};
+
+uthread_chan_t uthread_chan_create(size_t elem_size, size_t capacity)
+{
+	struct uthread_chan *chan;
+
+	if (elem_size == 0 ||
+	    capacity > (SIZE_MAX - sizeof(*chan)) / elem_size)
+		return NULL;
+
+	chan = malloc(sizeof(*chan) + capacity * elem_size);
+	if (chan == NULL)
+		return NULL;
+
+	spin_init(&chan->lock);
+	chan->elem_size = elem_size;
+	chan->capacity = capacity;
+	chan->head = 0;
+	chan->count = 0;
+	list_init(&chan->senders);
+	list_init(&chan->receivers);
+	return chan;
+}
+
+int uthread_chan_destroy(uthread_chan_t chan)
+{
+	if (chan == NULL || !list_empty(&chan->senders) ||
+	    !list_empty(&chan->receivers))
+		return -1;
+
+	free(chan);
+	return 0;
+}
+
+// Function to get the slot of the @i-th element of the buffer of @chan
+static inline void *chan_slot(struct uthread_chan *chan, size_t i)
+{
+	i += chan->head;
+	if (i >= chan->capacity)
+		i -= chan->capacity;
+	return chan->buf + i * chan->elem_size;
+}
+
+// Function to take the oldest thread blocked in @waiters, NULL if none
+static struct uthread_tcb *chan_pop(struct list_head *waiters)
+{
+	struct list_head *node = list_pop(waiters);
+
+	return node ? list_entry(node, struct uthread_tcb, node) : NULL;
+}
+
+// Function to block the current thread @self in @waiters until another one
+// copies its element, with the lock of @chan held and preemption disabled
+static void chan_wait(struct uthread_chan *chan, struct list_head *waiters,
+		      struct uthread_tcb *self, void *elem)
+{
+	self->chan_elem = elem;
+	list_add_tail(&self->node, waiters);
+	trace_uthread(TRACE_CHAN_WAIT, self, (uintptr_t)chan);
+	// The lock is only released once we are switched out
+	uthread_block(&chan->lock);
+}
+
+int uthread_chan_send(uthread_chan_t chan, const void *elem)
+{
+	struct uthread_tcb *receiver;
+
+	if (chan == NULL || elem == NULL)
+		return -1;
+
+	preempt_disable();
+	spin_lock(&chan->lock);
+	receiver = chan_pop(&chan->receivers);
+	if (receiver != NULL) {
+		// Straight to the receiver, so that it doesn't have to come
+		// back for it, nor wait for us to run again
+		memcpy(uthread_stack_addr(receiver, receiver->chan_elem), elem,
+		       chan->elem_size);
+	} else if (chan->count < chan->capacity) {
+		memcpy(chan_slot(chan, chan->count), elem, chan->elem_size);
+		chan->count++;
+	} else {
+		chan_wait(chan, &chan->senders, uthread_current(),
+			  (void *)elem);
+		preempt_enable();
+		return 0;
+	}
+	spin_unlock(&chan->lock);
+	uthread_wake(receiver);
+	preempt_enable();
+	return 0;
+}
+
+int uthread_chan_recv(uthread_chan_t chan, void *elem)
+{
+	struct uthread_tcb *sender;
+	void *sent;
+
+	if (chan == NULL || elem == NULL)
+		return -1;
+
+	preempt_disable();
+	spin_lock(&chan->lock);
+	sender = chan_pop(&chan->senders);
+	if (chan->count) {
+		memcpy(elem, chan_slot(chan, 0), chan->elem_size);
+		chan->head = chan->head + 1 < chan->capacity ?
+			     chan->head + 1 : 0;
+		chan->count--;
+		if (sender != NULL) {
+			// The oldest sender takes the room, behind the others
+			sent = uthread_stack_addr(sender, sender->chan_elem);
+			memcpy(chan_slot(chan, chan->count), sent,
+			       chan->elem_size);
+			chan->count++;
+		}
+	} else if (sender != NULL) {
+		// Unbuffered: straight from the sender
+		sent = uthread_stack_addr(sender, sender->chan_elem);
+		memcpy(elem, sent, chan->elem_size);
+	} else {
+		chan_wait(chan, &chan->receivers, uthread_current(), elem);
+		preempt_enable();
+		return 0;
+	}
+	spin_unlock(&chan->lock);
+	uthread_wake(sender);
+	preempt_enable();
+	return 0;
+}
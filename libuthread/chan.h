@@ -0,0 +1,77 @@
+#ifndef _UTHREAD_CHAN_H
+#define _UTHREAD_CHAN_H
+
+#include <stddef.h>
+
+/*
+ * Channels
+ *
+ * A channel passes elements of a fixed size from sending threads to receiving
+ * threads, in the order they were sent. A buffered channel holds up to its
+ * capacity of elements in a ring buffer: sending only blocks while it is full,
+ * and receiving while it is empty. An unbuffered channel holds none, and each
+ * sender meets a receiver (rendezvous).
+ *
+ * Elements are copied straight from a sender to a receiver blocked waiting for
+ * one, and from a blocked sender to the buffer as soon as there is room, so
+ * that each thread woken up is done with its element. Threads blocked on a
+ * channel are served oldest first.
+ *
+ * All these functions must be called by uthreads.
+ */
+
+/*
+ * uthread_chan_t - Channel type
+ */
+typedef struct uthread_chan *uthread_chan_t;
+
+/*
+ * uthread_chan_create - Create a channel
+ * @elem_size: Size of the elements, in bytes
+ * @capacity: Number of elements the channel can hold, 0 for an unbuffered
+ * channel
+ *
+ * Return: Pointer to a new empty channel. NULL if @elem_size is 0, or in case
+ * of failure when allocating the new channel.
+ */
+uthread_chan_t uthread_chan_create(size_t elem_size, size_t capacity);
+
+/*
+ * uthread_chan_destroy - Deallocate a channel
+ * @chan: Channel to deallocate
+ *
+ * Elements still in the buffer of @chan are dropped.
+ *
+ * Return: -1 if @chan is NULL or if threads are still blocked on it. 0 if
+ * @chan was successfully destroyed.
+ */
+int uthread_chan_destroy(uthread_chan_t chan);
+
+/*
+ * uthread_chan_send - Send an element through a channel
+ * @chan: Channel to send through
+ * @elem: Element to send, of the size of the elements of @chan
+ *
+ * If a thread is blocked receiving from @chan, @elem is copied to it, and it is
+ * made ready. Otherwise, @elem is copied to the buffer of @chan, if not full.
+ * Otherwise, the calling thread is blocked until a receiver takes @elem.
+ *
+ * Return: -1 if @chan or @elem is NULL. 0 once @elem was sent.
+ */
+int uthread_chan_send(uthread_chan_t chan, const void *elem);
+
+/*
+ * uthread_chan_recv - Receive an element from a channel
+ * @chan: Channel to receive from
+ * @elem: Where to copy the element received
+ *
+ * The oldest element in the buffer of @chan is received, and the oldest thread
+ * blocked sending to @chan, if any, gets to put its element in the buffer. On
+ * an unbuffered channel, the element comes straight from that thread. If there
+ * is none, the calling thread is blocked until an element is sent.
+ *
+ * Return: -1 if @chan or @elem is NULL. 0 once an element was received.
+ */
+int uthread_chan_recv(uthread_chan_t chan, void *elem);
+
+#endif /* _UTHREAD_CHAN_H */
@@ -1,32 +1,422 @@
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "private.h"
 #include "uthread.h"
 
-/* Size of the stack for a thread (in bytes) */
-#define UTHREAD_STACK_SIZE 32768
+/* Smallest and largest sizes of stack kept in the stack cache */
+#define STACK_CLASS_MIN UTHREAD_STACK_MIN
+#define STACK_CLASS_MAX (8 << 20)
+
+/* Number of stack sizes in the stack cache, one per power of two */
+#define STACK_CLASSES 11
+
+/*
+ * Default maximum number of free stacks of each size kept in the stack cache,
+ * enough for bursts of a thousand threads to reuse the stacks of the previous
+ * burst instead of mapping new ones
+ */
+#define UTHREAD_STACK_CACHE 1024
+
+/*
+ * Number of cached stacks kept fully resident; stacks cached beyond that get
+ * their pages trimmed
+ */
+#define UTHREAD_STACK_HOT 8
+
+/*
+ * Stack cache
+ *
+ * Stacks are mapped with a PROT_NONE guard page below them, so that an overflow
+ * faults instead of silently corrupting the memory below. Their size is rounded
+ * up to a power of two, and freed stacks are kept on a LIFO free list per size
+ * up to a high-water mark, with the link to the next free stack stored in their
+ * topmost word. Stacks bigger than STACK_CLASS_MAX are not cached.
+ *
+ * Each kernel thread (i.e., each worker of the M:N scheduler) has a cache of its
+ * own, so that no locking is needed.
+ */
+static __thread struct {
+	struct {
+		void *head;	/* Most recently freed stack */
+		size_t count;	/* Number of stacks in the list */
+	} classes[STACK_CLASSES]; /* Free lists, from STACK_CLASS_MIN up */
+	size_t page;		/* Page size (also size of the guard) */
+	size_t max;		/* Last high-water mark applied to the lists */
+} stacks;
+
+/*
+ * High-water mark of every cache, which each worker applies to its own cache
+ * the next time it uses it
+ */
+static atomic_size_t stacks_max = UTHREAD_STACK_CACHE;
+
+#if defined(__x86_64__)
+/*
+ * uthread_ctx_swap - Register-only context switch
+ * @prev_sp: Where to store the stack pointer of the outgoing context
+ * @next_sp: Stack pointer of the incoming context
+ *
+ * Push the callee-saved registers (rbp, rbx, r12-r15) as well as the MXCSR and
+ * x87 control words on the current stack, save the stack pointer in @prev_sp,
+ * then load @next_sp and pop the same frame back.
+ *
+ * uthread_ctx_swap_via(prev_sp, next_sp, stack, func, arg) does the same, but
+ * calls func(arg) with @stack as stack pointer in between, once the outgoing
+ * context is saved, and only then reads the stack pointer to load from *next_sp.
+ *
+ * uthread_ctx_entry is the first return address of a fresh context, and calls
+ * %rbx(%r12, %r13), i.e. uthread_ctx_bootstrap(func, arg).
+ */
+__asm__(
+	"	.text\n"
+	"	.p2align 4\n"
+	"	.type uthread_ctx_swap, @function\n"
+	"uthread_ctx_swap:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	subq $8, %rsp\n"
+	"	stmxcsr (%rsp)\n"
+	"	fnstcw 4(%rsp)\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq %rsi, %rsp\n"
+	"	ldmxcsr (%rsp)\n"
+	"	fldcw 4(%rsp)\n"
+	"	addq $8, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	"	.size uthread_ctx_swap, .-uthread_ctx_swap\n"
+	"\n"
+	"	.p2align 4\n"
+	"	.type uthread_ctx_swap_via, @function\n"
+	"uthread_ctx_swap_via:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	subq $8, %rsp\n"
+	"	stmxcsr (%rsp)\n"
+	"	fnstcw 4(%rsp)\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq %rsi, %rbx\n"
+	"	movq %rdx, %rsp\n"
+	"	movq %r8, %rdi\n"
+	"	callq *%rcx\n"
+	"	movq (%rbx), %rsp\n"
+	"	ldmxcsr (%rsp)\n"
+	"	fldcw 4(%rsp)\n"
+	"	addq $8, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	"	.size uthread_ctx_swap_via, .-uthread_ctx_swap_via\n"
+	"\n"
+	"	.p2align 4\n"
+	"	.type uthread_ctx_entry, @function\n"
+	"uthread_ctx_entry:\n"
+	"	movq %r12, %rdi\n"
+	"	movq %r13, %rsi\n"
+	"	callq *%rbx\n"
+	"	ud2\n"
+	"	.size uthread_ctx_entry, .-uthread_ctx_entry\n"
+);
+
+/* Number of words in the initial frame built by uthread_ctx_init() */
+#define CTX_FRAME_WORDS 8
+#elif defined(__aarch64__)
+/*
+ * uthread_ctx_swap - Register-only context switch
+ * @prev_sp: Where to store the stack pointer of the outgoing context
+ * @next_sp: Stack pointer of the incoming context
+ *
+ * Store the callee-saved registers (x19-x30, d8-d15) in a 160-byte frame on
+ * the current stack, save the stack pointer in @prev_sp, then load @next_sp,
+ * reload the same frame and return through x30.
+ *
+ * uthread_ctx_swap_via(prev_sp, next_sp, stack, func, arg) does the same, but
+ * calls func(arg) with @stack as stack pointer in between, once the outgoing
+ * context is saved, and only then reads the stack pointer to load from *next_sp.
+ *
+ * uthread_ctx_entry is the first return address of a fresh context, and calls
+ * x19(x20, x21), i.e. uthread_ctx_bootstrap(func, arg).
+ */
+__asm__(
+	"	.text\n"
+	"	.p2align 4\n"
+	"	.type uthread_ctx_swap, %function\n"
+	"uthread_ctx_swap:\n"
+	"	sub sp, sp, #160\n"
+	"	stp x19, x20, [sp, #0]\n"
+	"	stp x21, x22, [sp, #16]\n"
+	"	stp x23, x24, [sp, #32]\n"
+	"	stp x25, x26, [sp, #48]\n"
+	"	stp x27, x28, [sp, #64]\n"
+	"	stp x29, x30, [sp, #80]\n"
+	"	stp d8, d9, [sp, #96]\n"
+	"	stp d10, d11, [sp, #112]\n"
+	"	stp d12, d13, [sp, #128]\n"
+	"	stp d14, d15, [sp, #144]\n"
+	"	mov x9, sp\n"
+	"	str x9, [x0]\n"
+	"	mov sp, x1\n"
+	"	ldp x19, x20, [sp, #0]\n"
+	"	ldp x21, x22, [sp, #16]\n"
+	"	ldp x23, x24, [sp, #32]\n"
+	"	ldp x25, x26, [sp, #48]\n"
+	"	ldp x27, x28, [sp, #64]\n"
+	"	ldp x29, x30, [sp, #80]\n"
+	"	ldp d8, d9, [sp, #96]\n"
+	"	ldp d10, d11, [sp, #112]\n"
+	"	ldp d12, d13, [sp, #128]\n"
+	"	ldp d14, d15, [sp, #144]\n"
+	"	add sp, sp, #160\n"
+	"	ret\n"
+	"	.size uthread_ctx_swap, .-uthread_ctx_swap\n"
+	"\n"
+	"	.p2align 4\n"
+	"	.type uthread_ctx_swap_via, %function\n"
+	"uthread_ctx_swap_via:\n"
+	"	sub sp, sp, #160\n"
+	"	stp x19, x20, [sp, #0]\n"
+	"	stp x21, x22, [sp, #16]\n"
+	"	stp x23, x24, [sp, #32]\n"
+	"	stp x25, x26, [sp, #48]\n"
+	"	stp x27, x28, [sp, #64]\n"
+	"	stp x29, x30, [sp, #80]\n"
+	"	stp d8, d9, [sp, #96]\n"
+	"	stp d10, d11, [sp, #112]\n"
+	"	stp d12, d13, [sp, #128]\n"
+	"	stp d14, d15, [sp, #144]\n"
+	"	mov x9, sp\n"
+	"	str x9, [x0]\n"
+	"	mov x19, x1\n"
+	"	mov sp, x2\n"
+	"	mov x0, x4\n"
+	"	blr x3\n"
+	"	ldr x9, [x19]\n"
+	"	mov sp, x9\n"
+	"	ldp x19, x20, [sp, #0]\n"
+	"	ldp x21, x22, [sp, #16]\n"
+	"	ldp x23, x24, [sp, #32]\n"
+	"	ldp x25, x26, [sp, #48]\n"
+	"	ldp x27, x28, [sp, #64]\n"
+	"	ldp x29, x30, [sp, #80]\n"
+	"	ldp d8, d9, [sp, #96]\n"
+	"	ldp d10, d11, [sp, #112]\n"
+	"	ldp d12, d13, [sp, #128]\n"
+	"	ldp d14, d15, [sp, #144]\n"
+	"	add sp, sp, #160\n"
+	"	ret\n"
+	"	.size uthread_ctx_swap_via, .-uthread_ctx_swap_via\n"
+	"\n"
+	"	.p2align 4\n"
+	"	.type uthread_ctx_entry, %function\n"
+	"uthread_ctx_entry:\n"
+	"	mov x0, x20\n"
+	"	mov x1, x21\n"
+	"	blr x19\n"
+	"	brk #0\n"
+	"	.size uthread_ctx_entry, .-uthread_ctx_entry\n"
+);
+
+/* Number of words in the initial frame built by uthread_ctx_init() */
+#define CTX_FRAME_WORDS 20
+#endif
+
+#if defined(__x86_64__) || defined(__aarch64__)
+void uthread_ctx_swap(void **prev_sp, void *next_sp);
+void uthread_ctx_swap_via(void **prev_sp, void **next_sp, void *stack,
+			  void (*func)(void *), void *arg);
+void uthread_ctx_entry(void);
+#endif
 
 void uthread_ctx_switch(uthread_ctx_t *prev, uthread_ctx_t *next)
 {
+#if defined(__x86_64__) || defined(__aarch64__)
+	uthread_ctx_swap(&prev->sp, next->sp);
+#else
 	/*
 	 * swapcontext() saves the current context in structure pointer by @prev
 	 * and actives the context pointed by @next
 	 */
-	if (swapcontext(prev, next)) {
+	if (swapcontext(&prev->uc, &next->uc)) {
 		perror("swapcontext");
 		exit(1);
 	}
+#endif
 }
 
-void *uthread_ctx_alloc_stack(void)
+#if defined(__x86_64__) || defined(__aarch64__)
+void uthread_ctx_switch_via(uthread_ctx_t *prev, uthread_ctx_t *next,
+			    void *top_of_stack, size_t size,
+			    void (*func)(void *), void *arg)
 {
-	return malloc(UTHREAD_STACK_SIZE);
+	uintptr_t top = ((uintptr_t)top_of_stack + size) & ~(uintptr_t)15;
+
+	uthread_ctx_swap_via(&prev->sp, &next->sp, (void *)top, func, arg);
 }
+#endif
 
-void uthread_ctx_destroy_stack(void *top_of_stack)
+/* Size of the stacks of a class */
+static size_t stack_class_size(unsigned int class)
 {
-	free(top_of_stack);
+	return (size_t)STACK_CLASS_MIN << class;
+}
+
+/* Class of a stack of @size bytes, as rounded by uthread_ctx_stack_size() */
+static unsigned int stack_class(size_t size)
+{
+	return __builtin_ctzl(size / STACK_CLASS_MIN);
+}
+
+/* Address of the free list link of a cached stack */
+static void **stack_link(void *stack, size_t size)
+{
+	return (void **)((char *)stack + size) - 1;
+}
+
+/*
+ * Page size, i.e., size of the guard page. Workers other than the first never
+ * size a stack but free the stacks of threads that migrated to them, hence the
+ * lazy initialization on every path.
+ */
+static size_t stack_page(void)
+{
+	if (!stacks.page)
+		stacks.page = sysconf(_SC_PAGESIZE);
+	return stacks.page;
+}
+
+/* Unmap a stack along with its guard page */
+static void stack_unmap(void *stack, size_t size)
+{
+	size_t page = stack_page();
+
+	munmap((char *)stack - page, size + page);
+}
+
+/* Release the cached stacks above @max, in every class */
+static void stack_trim(size_t max)
+{
+	for (unsigned int class = 0; class < STACK_CLASSES; class++) {
+		size_t size = stack_class_size(class);
+
+		while (stacks.classes[class].count > max) {
+			void *stack = stacks.classes[class].head;
+
+			stacks.classes[class].head = *stack_link(stack, size);
+			stacks.classes[class].count--;
+			stack_unmap(stack, size);
+		}
+	}
+}
+
+/* High-water mark of the cache, after trimming it if it was just lowered */
+static size_t stack_max(void)
+{
+	size_t max = atomic_load_explicit(&stacks_max, memory_order_relaxed);
+
+	if (max != stacks.max) {
+		stacks.max = max;
+		stack_trim(max);
+	}
+	return max;
+}
+
+void uthread_set_stack_cache(size_t max_stacks)
+{
+	atomic_store_explicit(&stacks_max, max_stacks, memory_order_relaxed);
+	stack_max();
+}
+
+void uthread_ctx_flush_stacks(void)
+{
+	stack_trim(0);
+}
+
+size_t uthread_ctx_stack_size(size_t size)
+{
+	size_t page = stack_page();
+
+	if (size > STACK_CLASS_MAX)
+		return (size + page - 1) & ~(page - 1);
+	if (size <= STACK_CLASS_MIN)
+		return STACK_CLASS_MIN;
+	return (size_t)1 << (64 - __builtin_clzl(size - 1));
+}
+
+void *uthread_ctx_alloc_stack(size_t size)
+{
+	size_t page = stack_page();
+	char *map;
+
+	/* Reuse the most recently freed stack, which is likely still hot */
+	if (size <= STACK_CLASS_MAX && stack_max()) {
+		unsigned int class = stack_class(size);
+		void *stack = stacks.classes[class].head;
+
+		if (stack) {
+			stacks.classes[class].head = *stack_link(stack, size);
+			stacks.classes[class].count--;
+			return stack;
+		}
+	}
+
+	map = mmap(NULL, size + page, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	/* Lowest page is the guard */
+	if (mprotect(map, page, PROT_NONE)) {
+		munmap(map, size + page);
+		return NULL;
+	}
+
+	return map + page;
+}
+
+void uthread_ctx_destroy_stack(void *top_of_stack, size_t size)
+{
+	unsigned int class;
+
+	if (size > STACK_CLASS_MAX ||
+	    stacks.classes[stack_class(size)].count >= stack_max()) {
+		stack_unmap(top_of_stack, size);
+		return;
+	}
+	class = stack_class(size);
+
+	/*
+	 * Past the first few cached stacks, give the pages that were touched
+	 * back to the kernel. The topmost page, which holds the free list link,
+	 * stays resident.
+	 */
+	if (stacks.classes[class].count >= UTHREAD_STACK_HOT)
+		madvise(top_of_stack, size - stack_page(), MADV_DONTNEED);
+
+	*stack_link(top_of_stack, size) = stacks.classes[class].head;
+	stacks.classes[class].head = top_of_stack;
+	stacks.classes[class].count++;
 }
 
 /*
@@ -37,29 +427,63 @@ void uthread_ctx_destroy_stack(void *top_of_stack)
 static void uthread_ctx_bootstrap(uthread_func_t func, void *arg)
 {
 	/*
-	 * Enable interrupts right after being elected to run for the first time
+	 * Enable interrupts right after being elected to run for the first time,
+	 * once done with the thread that was switched out
 	 */
+	uthread_switch_finish();
 	preempt_enable();
 
 	/* Execute thread and when done, exit */
 	func(arg);
-	uthread_exit();
+	uthread_exit(NULL);
 }
 
-int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
+int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack, size_t size,
 		     uthread_func_t func, void *arg)
 {
+#if defined(__x86_64__) || defined(__aarch64__)
+	uintptr_t *frame;
+	uintptr_t top = (uintptr_t)top_of_stack + size;
+
+	/*
+	 * Build an initial frame at the (16-byte aligned) end of the stack, as
+	 * if uthread_ctx_swap() had been called from uthread_ctx_entry(). Two
+	 * extra words are left above the frame, which keeps the stack aligned
+	 * when uthread_ctx_entry() calls uthread_ctx_bootstrap()
+	 */
+	top &= ~(uintptr_t)15;
+	frame = (uintptr_t *)top - CTX_FRAME_WORDS - 2;
+	for (int i = 0; i < CTX_FRAME_WORDS + 2; i++)
+		frame[i] = 0;
+
+#if defined(__x86_64__)
+	frame[0] = 0x037fULL << 32 | 0x1f80;	/* x87 control word, MXCSR */
+	frame[3] = (uintptr_t)arg;		/* r13 */
+	frame[4] = (uintptr_t)func;		/* r12 */
+	frame[5] = (uintptr_t)uthread_ctx_bootstrap; /* rbx */
+	frame[7] = (uintptr_t)uthread_ctx_entry; /* return address */
+#else
+	frame[0] = (uintptr_t)uthread_ctx_bootstrap; /* x19 */
+	frame[1] = (uintptr_t)func;		/* x20 */
+	frame[2] = (uintptr_t)arg;		/* x21 */
+	frame[11] = (uintptr_t)uthread_ctx_entry; /* x30 */
+#endif
+
+	uctx->sp = frame;
+
+	return 0;
+#else
 	/*
 	 * Initialize the passed context @uctx to the currently active context
 	 */
-	if (getcontext(uctx))
+	if (getcontext(&uctx->uc))
 		return -1;
 
 	/*
 	 * Change context @uctx's stack to the specified stack
 	 */
-	uctx->uc_stack.ss_sp = top_of_stack;
-	uctx->uc_stack.ss_size = UTHREAD_STACK_SIZE;
+	uctx->uc.uc_stack.ss_sp = top_of_stack;
+	uctx->uc.uc_stack.ss_size = size;
 
 	/*
 	 * Finish setting up context @uctx:
@@ -68,9 +492,9 @@ int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
 	 * - when called, function uthread_ctx_bootstrap() will receive two
 	 *   arguments: @func and @arg
 	 */
-	makecontext(uctx, (void (*)(void)) uthread_ctx_bootstrap,
+	makecontext(&uctx->uc, (void (*)(void)) uthread_ctx_bootstrap,
 		    2, func, arg);
 
 	return 0;
+#endif
 }
-
@@ -0,0 +1,109 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "deque.h"
+
+/* Initial number of slots of a deque (must be a power of two) */
+#define DEQUE_CAPACITY 64
+
+struct deque_array {
+	long size;			/* Number of slots, a power of two */
+	struct deque_array *next;	/* Next retired array */
+	_Atomic(void *) items[];
+};
+
+static struct deque_array *deque_array_alloc(long size)
+{
+	struct deque_array *a;
+
+	a = malloc(sizeof(*a) + size * sizeof(a->items[0]));
+	if (a == NULL)
+		return NULL;
+	a->size = size;
+	a->next = NULL;
+	return a;
+}
+
+int deque_init(struct deque *dq)
+{
+	struct deque_array *a = deque_array_alloc(DEQUE_CAPACITY);
+
+	if (a == NULL)
+		return -1;
+	atomic_init(&dq->top, 0);
+	atomic_init(&dq->bottom, 0);
+	atomic_init(&dq->array, a);
+	dq->retired = NULL;
+	return 0;
+}
+
+void deque_destroy(struct deque *dq)
+{
+	struct deque_array *a = atomic_load(&dq->array);
+
+	free(a);
+	while ((a = dq->retired) != NULL) {
+		dq->retired = a->next;
+		free(a);
+	}
+}
+
+int deque_push(struct deque *dq, void *item)
+{
+	long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+	long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+	struct deque_array *a = atomic_load_explicit(&dq->array,
+						     memory_order_relaxed);
+
+	if (b - t > a->size - 1) {
+		/* Full: move the items to an array twice as big */
+		struct deque_array *bigger = deque_array_alloc(a->size * 2);
+
+		if (bigger == NULL)
+			return -1;
+		for (long i = t; i < b; i++)
+			atomic_store_explicit(&bigger->items[i & (bigger->size - 1)],
+				atomic_load_explicit(&a->items[i & (a->size - 1)],
+						     memory_order_relaxed),
+				memory_order_relaxed);
+		atomic_store_explicit(&dq->array, bigger, memory_order_release);
+		a->next = dq->retired;
+		dq->retired = a;
+		a = bigger;
+	}
+
+	atomic_store_explicit(&a->items[b & (a->size - 1)], item,
+			      memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+	return 0;
+}
+
+void *deque_steal(struct deque *dq)
+{
+	long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	long b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+	struct deque_array *a;
+	void *item;
+
+	if (t >= b)
+		return NULL;
+
+	a = atomic_load_explicit(&dq->array, memory_order_acquire);
+	item = atomic_load_explicit(&a->items[t & (a->size - 1)],
+				    memory_order_relaxed);
+	if (!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+						     memory_order_seq_cst,
+						     memory_order_relaxed))
+		return NULL;
+	return item;
+}
+
+long deque_size(struct deque *dq)
+{
+	long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+	long t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+
+	return b > t ? b - t : 0;
+}
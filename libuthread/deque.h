@@ -0,0 +1,72 @@
+#ifndef _UTHREAD_DEQUE_H
+#define _UTHREAD_DEQUE_H
+
+/*
+ * Work-stealing deque
+ *
+ * Chase-Lev deque, as formalized for C11 atomics by Lê et al. ("Correct and
+ * Efficient Work-Stealing for Weak Memory Models", PPoPP 2013). Only the owner
+ * of a deque pushes items to its bottom end, while any thread, the owner
+ * included, can take items from its top end. Items are therefore taken in FIFO
+ * order.
+ *
+ * The circular array grows when full. Arrays that got replaced are only freed
+ * along with the deque itself, since thieves may still be reading from them.
+ *
+ * Like the rest of the private headers, this is only meant to be used within
+ * libuthread.
+ */
+
+#include <stdatomic.h>
+
+struct deque_array;
+
+struct deque {
+	atomic_long top;	/* Next item to be taken */
+	atomic_long bottom;	/* Next free slot, owner only */
+	_Atomic(struct deque_array *) array;
+	struct deque_array *retired;	/* Arrays replaced by bigger ones */
+};
+
+/*
+ * deque_init - Initialize an empty deque
+ * @dq: Deque to initialize
+ *
+ * Return: -1 in case of memory allocation error, 0 otherwise
+ */
+int deque_init(struct deque *dq);
+
+/*
+ * deque_destroy - Free the memory of a deque
+ * @dq: Deque to destroy, which no other thread may access anymore
+ */
+void deque_destroy(struct deque *dq);
+
+/*
+ * deque_push - Push item at the bottom of a deque
+ * @dq: Deque to push to, owned by the calling thread
+ * @item: Item to push
+ *
+ * Return: -1 in case of memory allocation error when growing, 0 otherwise
+ */
+int deque_push(struct deque *dq, void *item);
+
+/*
+ * deque_steal - Take the item at the top of a deque
+ * @dq: Deque to take from
+ *
+ * Return: Oldest item of @dq, or NULL if @dq was empty or if another thread
+ * concurrently took the same item
+ */
+void *deque_steal(struct deque *dq);
+
+/*
+ * deque_size - Number of items in a deque
+ * @dq: Deque to measure
+ *
+ * Return: Number of items, which may already be outdated if other threads
+ * access @dq concurrently
+ */
+long deque_size(struct deque *dq);
+
+#endif /* _UTHREAD_DEQUE_H */
@@ -0,0 +1,181 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "io.h"
+#include "private.h"
+#include "uring.h"
+
+bool uthread_io_uring;
+
+// Function to switch a file descriptor to non-blocking mode
+static int set_nonblock(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+
+	if (flags < 0)
+		return -1;
+	if (flags & O_NONBLOCK)
+		return 0;
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Function to check if an I/O failure means the descriptor isn't ready yet
+static bool io_again(void)
+{
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+/*
+ * Function to perform an operation through the ring of the worker
+ *
+ * Returns false if it could not be submitted. Otherwise, stores the result of
+ * the operation in @ret, with errno set if it failed.
+ */
+static bool io_ring(struct io_uring_sqe *sqe, ssize_t *ret)
+{
+	int res;
+
+	if (!uthread_io_uring || uthread_io_submit(sqe, &res))
+		return false;
+	if (res < 0) {
+		errno = -res;
+		*ret = -1;
+	} else {
+		*ret = res;
+	}
+	return true;
+}
+
+// Function to perform a read or write operation through the ring
+static bool io_ring_rw(uint8_t opcode, int fd, const void *buf, size_t count,
+		       uint64_t offset, ssize_t *ret)
+{
+	struct io_uring_sqe sqe = {
+		.opcode = opcode,
+		.fd = fd,
+		.addr = (uintptr_t)buf,
+		.len = count > INT_MAX ? INT_MAX : count,
+		.off = offset,
+	};
+
+	return io_ring(&sqe, ret);
+}
+
+int uthread_set_io_uring(bool enable)
+{
+	if (enable) {
+		// Check once and for all that the kernel supports it
+		struct uring *r = uring_open(1, -1);
+
+		if (r == NULL)
+			return -1;
+		uring_close(r);
+	}
+
+	uthread_io_uring = enable;
+	return 0;
+}
+
+ssize_t uthread_read(int fd, void *buf, size_t count)
+{
+	ssize_t ret;
+
+	// An offset of -1 reads from the current position, if any. If the
+	// descriptor is non-blocking, the ring may fail with EAGAIN as well
+	if (io_ring_rw(IORING_OP_READ, fd, buf, count, -1, &ret) &&
+	    (ret >= 0 || !io_again()))
+		return ret;
+
+	// Sockets can be read without blocking regardless of their mode
+	ret = recv(fd, buf, count, MSG_DONTWAIT);
+	if (ret >= 0 || errno != ENOTSOCK) {
+		while (ret < 0 && io_again()) {
+			if (uthread_wait_fd(fd, EPOLLIN))
+				return -1;
+			ret = recv(fd, buf, count, MSG_DONTWAIT);
+		}
+		return ret;
+	}
+
+	// Other descriptors (e.g. pipes, terminals) need to be non-blocking
+	if (set_nonblock(fd))
+		return -1;
+	while ((ret = read(fd, buf, count)) < 0 && io_again())
+		if (uthread_wait_fd(fd, EPOLLIN))
+			return -1;
+	return ret;
+}
+
+ssize_t uthread_write(int fd, const void *buf, size_t count)
+{
+	ssize_t ret;
+
+	if (io_ring_rw(IORING_OP_WRITE, fd, buf, count, -1, &ret) &&
+	    (ret >= 0 || !io_again()))
+		return ret;
+
+	ret = send(fd, buf, count, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (ret >= 0 || errno != ENOTSOCK) {
+		while (ret < 0 && io_again()) {
+			if (uthread_wait_fd(fd, EPOLLOUT))
+				return -1;
+			ret = send(fd, buf, count, MSG_DONTWAIT | MSG_NOSIGNAL);
+		}
+		return ret;
+	}
+
+	if (set_nonblock(fd))
+		return -1;
+	while ((ret = write(fd, buf, count)) < 0 && io_again())
+		if (uthread_wait_fd(fd, EPOLLOUT))
+			return -1;
+	return ret;
+}
+
+ssize_t uthread_pread(int fd, void *buf, size_t count, off_t offset)
+{
+	ssize_t ret;
+
+	if (io_ring_rw(IORING_OP_READ, fd, buf, count, offset, &ret))
+		return ret;
+	return pread(fd, buf, count, offset);
+}
+
+ssize_t uthread_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+	ssize_t ret;
+
+	if (io_ring_rw(IORING_OP_WRITE, fd, buf, count, offset, &ret))
+		return ret;
+	return pwrite(fd, buf, count, offset);
+}
+
+int uthread_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
+{
+	struct io_uring_sqe sqe = {
+		.opcode = IORING_OP_ACCEPT,
+		.fd = sockfd,
+		.addr = (uintptr_t)addr,
+		.addr2 = (uintptr_t)addrlen,
+		.accept_flags = SOCK_NONBLOCK,
+	};
+	ssize_t ret;
+	int fd;
+
+	if (io_ring(&sqe, &ret) && (ret >= 0 || !io_again()))
+		return ret;
+
+	if (set_nonblock(sockfd))
+		return -1;
+	while ((fd = accept4(sockfd, addr, addrlen, SOCK_NONBLOCK)) < 0 &&
+	       io_again())
+		if (uthread_wait_fd(sockfd, EPOLLIN))
+			return -1;
+	return fd;
+}
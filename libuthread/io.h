@@ -0,0 +1,112 @@
+#ifndef _UTHREAD_IO_H
+#define _UTHREAD_IO_H
+
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+/*
+ * Non-blocking I/O
+ *
+ * The following functions behave like their system call counterparts, except
+ * that instead of blocking the whole kernel thread (and with it, every other
+ * uthread running on it) when the file descriptor isn't ready, they only block
+ * the calling thread until it is. They must be called by uthreads, and the file
+ * descriptors they are used on are switched to non-blocking mode.
+ *
+ * Only one thread at a time may wait for a given file descriptor.
+ *
+ * Waiting for readiness doesn't help with regular files, which are always
+ * "ready" and block in the kernel. With the io_uring backend enabled (see
+ * uthread_set_io_uring()), operations are instead submitted asynchronously, in
+ * batches, so that the I/O of different threads overlap.
+ */
+
+/*
+ * uthread_set_io_uring - Configure the I/O backend
+ * @enable: Perform I/O through io_uring if true, through epoll otherwise
+ *
+ * Each worker gets an io_uring instance of its own, to which the operations of
+ * its threads are queued. The queued operations are submitted with a single
+ * system call at every scheduling pass of the worker (when a thread yields, or
+ * when none is ready), and the threads are blocked until their operation
+ * completes. Only takes effect at the next call to uthread_run(). Threads with a
+ * shared stack (see uthread_attr_t) keep using epoll.
+ *
+ * Return: -1 if io_uring is not supported by the kernel, 0 otherwise
+ */
+int uthread_set_io_uring(bool enable);
+
+/*
+ * uthread_read - Read from a file descriptor
+ * @fd: File descriptor to read from
+ * @buf: Buffer to read into
+ * @count: Maximum number of bytes to read
+ *
+ * Block the calling thread until @fd is readable, then read up to @count bytes
+ * from it into @buf.
+ *
+ * Return: -1 in case of failure, with errno set. The number of bytes read
+ * otherwise, 0 meaning end of file.
+ */
+ssize_t uthread_read(int fd, void *buf, size_t count);
+
+/*
+ * uthread_write - Write to a file descriptor
+ * @fd: File descriptor to write to
+ * @buf: Buffer to write from
+ * @count: Maximum number of bytes to write
+ *
+ * Block the calling thread until @fd is writable, then write up to @count bytes
+ * from @buf into it.
+ *
+ * Return: -1 in case of failure, with errno set. The number of bytes written
+ * otherwise.
+ */
+ssize_t uthread_write(int fd, const void *buf, size_t count);
+
+/*
+ * uthread_pread - Read from a file at a given offset
+ * @fd: File descriptor to read from
+ * @buf: Buffer to read into
+ * @count: Maximum number of bytes to read
+ * @offset: Position in the file to read from
+ *
+ * Read up to @count bytes from @fd into @buf, like pread(). Without the
+ * io_uring backend, this blocks the worker.
+ *
+ * Return: -1 in case of failure, with errno set. The number of bytes read
+ * otherwise, 0 meaning end of file.
+ */
+ssize_t uthread_pread(int fd, void *buf, size_t count, off_t offset);
+
+/*
+ * uthread_pwrite - Write to a file at a given offset
+ * @fd: File descriptor to write to
+ * @buf: Buffer to write from
+ * @count: Maximum number of bytes to write
+ * @offset: Position in the file to write to
+ *
+ * Write up to @count bytes from @buf into @fd, like pwrite(). Without the
+ * io_uring backend, this blocks the worker.
+ *
+ * Return: -1 in case of failure, with errno set. The number of bytes written
+ * otherwise.
+ */
+ssize_t uthread_pwrite(int fd, const void *buf, size_t count, off_t offset);
+
+/*
+ * uthread_accept - Accept a connection on a socket
+ * @sockfd: Listening socket
+ * @addr: Address of the peer, or NULL
+ * @addrlen: Size of @addr, updated to the size of the address of the peer
+ *
+ * Block the calling thread until a connection is pending on @sockfd, then
+ * accept it. The new socket is in non-blocking mode already.
+ *
+ * Return: -1 in case of failure, with errno set. The file descriptor of the
+ * new socket otherwise.
+ */
+int uthread_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
+
+#endif /* _UTHREAD_IO_H */
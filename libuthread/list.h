@@ -0,0 +1,143 @@
+#ifndef _UTHREAD_LIST_H
+#define _UTHREAD_LIST_H
+
+/*
+ * Intrusive doubly linked lists
+ *
+ * Unlike queue_t, the links are embedded in the listed objects themselves, so
+ * adding and removing items never allocates memory. A list is circular and
+ * anchored on a struct list_head which is not part of any object; an empty list
+ * points to itself.
+ *
+ * Like the rest of the private headers, this is only meant to be used within
+ * libuthread.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct list_head {
+	struct list_head *next;
+	struct list_head *prev;
+};
+
+/*
+ * LIST_HEAD_INIT - Static initializer for an empty list
+ * @name: Name of the list head being initialized
+ */
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+
+/*
+ * list_entry - Get the object containing a list link
+ * @ptr: Pointer to the struct list_head link
+ * @type: Type of the containing object
+ * @member: Name of the link within @type
+ */
+#define list_entry(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+/*
+ * list_for_each_safe - Iterate over a list, allowing removal of the current link
+ * @pos: Current link
+ * @n: Temporary storage for the next link
+ * @head: List to iterate over
+ */
+#define list_for_each_safe(pos, n, head) \
+	for (pos = (head)->next, n = pos->next; pos != (head); \
+	     pos = n, n = pos->next)
+
+/*
+ * list_init - Initialize an empty list (or an unlinked node)
+ * @head: List to initialize
+ */
+static inline void list_init(struct list_head *head)
+{
+	head->next = head;
+	head->prev = head;
+}
+
+/*
+ * list_empty - Check whether a list is empty
+ * @head: List to check
+ *
+ * Also true for a node initialized with list_init() or removed with list_del().
+ */
+static inline bool list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+/*
+ * list_add_tail - Insert a node at the end of a list
+ * @node: Node to insert
+ * @head: List to insert into
+ */
+static inline void list_add_tail(struct list_head *node,
+				 struct list_head *head)
+{
+	node->prev = head->prev;
+	node->next = head;
+	head->prev->next = node;
+	head->prev = node;
+}
+
+/*
+ * list_add - Insert a node at the beginning of a list
+ * @node: Node to insert
+ * @head: List to insert into
+ */
+static inline void list_add(struct list_head *node, struct list_head *head)
+{
+	node->prev = head;
+	node->next = head->next;
+	head->next->prev = node;
+	head->next = node;
+}
+
+/*
+ * list_del - Remove a node from the list it belongs to
+ * @node: Node to remove
+ *
+ * The node is left as an empty list, so removing it twice is harmless.
+ */
+static inline void list_del(struct list_head *node)
+{
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+	list_init(node);
+}
+
+/*
+ * list_pop - Remove the first node of a list
+ * @head: List to remove from
+ *
+ * Return: Removed node, or NULL if @head is empty
+ */
+static inline struct list_head *list_pop(struct list_head *head)
+{
+	struct list_head *node = head->next;
+
+	if (node == head)
+		return NULL;
+	list_del(node);
+	return node;
+}
+
+/*
+ * list_splice_tail - Move all the nodes of a list to the end of another one
+ * @list: List to empty
+ * @head: List to append the nodes of @list to
+ */
+static inline void list_splice_tail(struct list_head *list,
+				    struct list_head *head)
+{
+	if (list_empty(list))
+		return;
+	list->next->prev = head->prev;
+	list->prev->next = head;
+	head->prev->next = list->next;
+	head->prev = list->prev;
+	list_init(list);
+}
+
+#endif /* _UTHREAD_LIST_H */
@@ -0,0 +1,318 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "mutex.h"
+#include "private.h"
+#include "uthread.h"
+
+// Flag of the owner of a mutex, set while threads may be waiting for it
+#define MUTEX_WAITERS ((uintptr_t)1)
+
+struct uthread_mutex {
+	// TCB of the owner, 0 if the mutex is free, ORed with MUTEX_WAITERS.
+	// Without waiters, taking and releasing the mutex only swap it
+	atomic_uintptr_t owner;
+	spinlock_t lock; // Protects waiters, and sets MUTEX_WAITERS
+	struct list_head waiters; // Threads waiting for the mutex, oldest first
+};
+
+struct uthread_cond {
+	spinlock_t lock; // Protects the rest, taken before the lock of mutex
+	struct list_head waiters; // Threads waiting, oldest first
+	struct uthread_mutex *mutex; // Mutex of the waiting threads
+};
+
+uthread_mutex_t uthread_mutex_create(void)
+{
+	struct uthread_mutex *mutex = malloc(sizeof(*mutex));
+
+	if (mutex == NULL)
+		return NULL;
+
+	atomic_init(&mutex->owner, 0);
+	spin_init(&mutex->lock);
+	list_init(&mutex->waiters);
+	return mutex;
+}
+
+int uthread_mutex_destroy(uthread_mutex_t mutex)
+{
+	if (mutex == NULL || atomic_load(&mutex->owner) != 0)
+		return -1;
+
+	free(mutex);
+	return 0;
+}
+
+/*
+ * Function to change the owner of @mutex from *@old to @owner, preemption
+ * disabled. Return false if the owner isn't *@old, which then gets the actual
+ * owner
+ */
+static inline bool owner_swap(struct uthread_mutex *mutex, uintptr_t *old,
+			      uintptr_t owner, memory_order order)
+{
+	uintptr_t cur;
+
+	if (uthread_parallel)
+		return atomic_compare_exchange_strong_explicit(
+			&mutex->owner, old, owner, order, memory_order_relaxed);
+
+	// With a single worker, nothing else runs until preemption is enabled
+	cur = atomic_load_explicit(&mutex->owner, memory_order_relaxed);
+	if (cur != *old) {
+		*old = cur;
+		return false;
+	}
+	atomic_store_explicit(&mutex->owner, owner, memory_order_relaxed);
+	return true;
+}
+
+// Function to check whether the current thread @self owns @mutex
+static bool mutex_owned(struct uthread_mutex *mutex, struct uthread_tcb *self)
+{
+	uintptr_t owner = atomic_load_explicit(&mutex->owner,
+					       memory_order_relaxed);
+
+	return (owner & ~MUTEX_WAITERS) == (uintptr_t)self;
+}
+
+/*
+ * Function to give @mutex to @uthread if it is free, or to put @uthread in line
+ * otherwise. Called with preemption disabled and the lock of @mutex held.
+ * Return whether @uthread got the mutex
+ */
+static bool mutex_enqueue(struct uthread_mutex *mutex,
+			  struct uthread_tcb *uthread)
+{
+	// Past this point, the owner can only release the mutex through
+	// mutex_handover(), which waits for the lock we hold
+	uintptr_t owner = atomic_fetch_or(&mutex->owner, MUTEX_WAITERS);
+
+	if (owner & ~MUTEX_WAITERS) {
+		list_add_tail(&uthread->node, &mutex->waiters);
+		return false;
+	}
+
+	// Released in the meantime. Nobody waits for a free mutex
+	atomic_store(&mutex->owner, (uintptr_t)uthread);
+	return true;
+}
+
+/*
+ * Function to release @mutex, handing it over to the oldest thread waiting for
+ * it. Called with preemption disabled and the lock of @mutex held. Return the
+ * thread to wake up, if any
+ */
+static struct uthread_tcb *mutex_handover(struct uthread_mutex *mutex)
+{
+	struct list_head *node = list_pop(&mutex->waiters);
+	struct uthread_tcb *next;
+
+	if (node == NULL) {
+		atomic_store(&mutex->owner, 0);
+		return NULL;
+	}
+
+	next = list_entry(node, struct uthread_tcb, node);
+	atomic_store(&mutex->owner, (uintptr_t)next |
+		     (list_empty(&mutex->waiters) ? 0 : MUTEX_WAITERS));
+	return next;
+}
+
+// Function to release @mutex, owned by the current thread @self, preemption
+// disabled
+static inline void mutex_release(struct uthread_mutex *mutex,
+				 struct uthread_tcb *self)
+{
+	uintptr_t owner = (uintptr_t)self;
+	struct uthread_tcb *next;
+
+	if (owner_swap(mutex, &owner, 0, memory_order_release))
+		return;
+
+	// Somebody waits
+	spin_lock(&mutex->lock);
+	next = mutex_handover(mutex);
+	spin_unlock(&mutex->lock);
+	uthread_wake(next);
+}
+
+// Function to wait until mutex_handover() gives @mutex to the current thread
+// @self, preemption disabled
+static __attribute__((noinline)) void mutex_wait(struct uthread_mutex *mutex,
+						 struct uthread_tcb *self)
+{
+	spin_lock(&mutex->lock);
+	if (mutex_enqueue(mutex, self)) {
+		spin_unlock(&mutex->lock);
+		return;
+	}
+	// The lock is only released once we are switched out
+	trace_uthread(TRACE_MUTEX_WAIT, self, (uintptr_t)mutex);
+	uthread_block(&mutex->lock);
+}
+
+int uthread_mutex_lock(uthread_mutex_t mutex)
+{
+	struct uthread_tcb *self;
+	uintptr_t owner = 0;
+	int ret = 0;
+
+	if (mutex == NULL)
+		return -1;
+
+	preempt_disable();
+	self = uthread_current();
+	if (!owner_swap(mutex, &owner, (uintptr_t)self, memory_order_acquire)) {
+		if ((owner & ~MUTEX_WAITERS) == (uintptr_t)self)
+			ret = -1;
+		else
+			mutex_wait(mutex, self);
+	}
+	preempt_enable();
+	return ret;
+}
+
+int uthread_mutex_trylock(uthread_mutex_t mutex)
+{
+	uintptr_t owner = 0;
+	bool taken;
+
+	if (mutex == NULL)
+		return -1;
+
+	preempt_disable();
+	taken = owner_swap(mutex, &owner, (uintptr_t)uthread_current(),
+			   memory_order_acquire);
+	preempt_enable();
+	return taken ? 0 : -1;
+}
+
+int uthread_mutex_unlock(uthread_mutex_t mutex)
+{
+	struct uthread_tcb *self;
+
+	if (mutex == NULL)
+		return -1;
+
+	preempt_disable();
+	self = uthread_current();
+	if (!mutex_owned(mutex, self)) {
+		preempt_enable();
+		return -1;
+	}
+	mutex_release(mutex, self);
+	preempt_enable();
+	return 0;
+}
+
+uthread_cond_t uthread_cond_create(void)
+{
+	struct uthread_cond *cond = malloc(sizeof(*cond));
+
+	if (cond == NULL)
+		return NULL;
+
+	spin_init(&cond->lock);
+	list_init(&cond->waiters);
+	cond->mutex = NULL;
+	return cond;
+}
+
+int uthread_cond_destroy(uthread_cond_t cond)
+{
+	if (cond == NULL || !list_empty(&cond->waiters))
+		return -1;
+
+	free(cond);
+	return 0;
+}
+
+int uthread_cond_wait(uthread_cond_t cond, uthread_mutex_t mutex)
+{
+	struct uthread_tcb *self;
+
+	if (cond == NULL || mutex == NULL)
+		return -1;
+
+	preempt_disable();
+	self = uthread_current();
+	if (!mutex_owned(mutex, self)) {
+		preempt_enable();
+		return -1;
+	}
+
+	// Signals can't be missed once in the list, as they need the lock of
+	// the condition variable, only released once we are switched out
+	spin_lock(&cond->lock);
+	cond->mutex = mutex;
+	list_add_tail(&self->node, &cond->waiters);
+	mutex_release(mutex, self);
+	uthread_block(&cond->lock);
+
+	// Moved to the line of the mutex by a signal, then given the mutex
+	preempt_enable();
+	return 0;
+}
+
+int uthread_cond_signal(uthread_cond_t cond)
+{
+	struct list_head *node;
+	struct uthread_tcb *woken = NULL;
+
+	if (cond == NULL)
+		return -1;
+
+	preempt_disable();
+	spin_lock(&cond->lock);
+	node = list_pop(&cond->waiters);
+	if (node != NULL) {
+		struct uthread_tcb *uthread =
+			list_entry(node, struct uthread_tcb, node);
+
+		spin_lock(&cond->mutex->lock);
+		if (mutex_enqueue(cond->mutex, uthread))
+			woken = uthread;
+		spin_unlock(&cond->mutex->lock);
+	}
+	spin_unlock(&cond->lock);
+	uthread_wake(woken);
+	preempt_enable();
+	return 0;
+}
+
+int uthread_cond_broadcast(uthread_cond_t cond)
+{
+	struct list_head *node;
+	struct uthread_tcb *woken = NULL;
+
+	if (cond == NULL)
+		return -1;
+
+	preempt_disable();
+	spin_lock(&cond->lock);
+	node = list_pop(&cond->waiters);
+	if (node != NULL) {
+		struct uthread_mutex *mutex = cond->mutex;
+		struct uthread_tcb *uthread =
+			list_entry(node, struct uthread_tcb, node);
+
+		// Only the first one may get the mutex right away, the others
+		// wait in line behind it
+		spin_lock(&mutex->lock);
+		if (mutex_enqueue(mutex, uthread))
+			woken = uthread;
+		if (!list_empty(&cond->waiters)) {
+			list_splice_tail(&cond->waiters, &mutex->waiters);
+			atomic_fetch_or(&mutex->owner, MUTEX_WAITERS);
+		}
+		spin_unlock(&mutex->lock);
+	}
+	spin_unlock(&cond->lock);
+	uthread_wake(woken);
+	preempt_enable();
+	return 0;
+}
@@ -0,0 +1,138 @@
+#ifndef _UTHREAD_MUTEX_H
+#define _UTHREAD_MUTEX_H
+
+/*
+ * Mutexes and condition variables
+ *
+ * A mutex is a lock owned by the thread that took it. Taking a free mutex, and
+ * releasing one nobody waits for, is a single atomic operation, without going
+ * through the scheduler. Threads that find the mutex taken wait in line, and
+ * each release hands the mutex over to the oldest of them, so that a woken up
+ * thread never has to wait again.
+ *
+ * A condition variable lets threads holding a mutex wait for another thread to
+ * signal them. Threads woken up get the mutex back before returning from
+ * uthread_cond_wait(): they are moved from the condition variable straight to
+ * the line of the mutex, instead of all competing for it at once.
+ *
+ * All these functions must be called by uthreads.
+ */
+
+/*
+ * uthread_mutex_t - Mutex type
+ */
+typedef struct uthread_mutex *uthread_mutex_t;
+
+/*
+ * uthread_cond_t - Condition variable type
+ */
+typedef struct uthread_cond *uthread_cond_t;
+
+/*
+ * uthread_mutex_create - Create a mutex
+ *
+ * Return: Pointer to a new free mutex. NULL in case of failure when allocating
+ * the new mutex.
+ */
+uthread_mutex_t uthread_mutex_create(void);
+
+/*
+ * uthread_mutex_destroy - Deallocate a mutex
+ * @mutex: Mutex to deallocate
+ *
+ * Return: -1 if @mutex is NULL or if it is taken. 0 if @mutex was successfully
+ * destroyed.
+ */
+int uthread_mutex_destroy(uthread_mutex_t mutex);
+
+/*
+ * uthread_mutex_lock - Take a mutex
+ * @mutex: Mutex to take
+ *
+ * If @mutex is taken, the calling thread is blocked until it gets released, and
+ * handed over to it.
+ *
+ * Return: -1 if @mutex is NULL, or already taken by the calling thread. 0 once
+ * @mutex was successfully taken.
+ */
+int uthread_mutex_lock(uthread_mutex_t mutex);
+
+/*
+ * uthread_mutex_trylock - Take a mutex, if free
+ * @mutex: Mutex to take
+ *
+ * Return: -1 if @mutex is NULL or taken. 0 if @mutex was successfully taken.
+ */
+int uthread_mutex_trylock(uthread_mutex_t mutex);
+
+/*
+ * uthread_mutex_unlock - Release a mutex
+ * @mutex: Mutex to release
+ *
+ * If threads are waiting for @mutex, it is handed over to the oldest of them,
+ * which is made ready to run. The calling thread keeps running.
+ *
+ * Return: -1 if @mutex is NULL, or not taken by the calling thread. 0 if @mutex
+ * was successfully released.
+ */
+int uthread_mutex_unlock(uthread_mutex_t mutex);
+
+/*
+ * uthread_cond_create - Create a condition variable
+ *
+ * Return: Pointer to a new condition variable. NULL in case of failure when
+ * allocating the new condition variable.
+ */
+uthread_cond_t uthread_cond_create(void);
+
+/*
+ * uthread_cond_destroy - Deallocate a condition variable
+ * @cond: Condition variable to deallocate
+ *
+ * Return: -1 if @cond is NULL or if threads are still waiting on it. 0 if @cond
+ * was successfully destroyed.
+ */
+int uthread_cond_destroy(uthread_cond_t cond);
+
+/*
+ * uthread_cond_wait - Wait on a condition variable
+ * @cond: Condition variable to wait on
+ * @mutex: Mutex taken by the calling thread
+ *
+ * Release @mutex and block the calling thread until @cond gets signaled, both
+ * at once so that no signal can be missed in between. The thread gets @mutex
+ * back before returning. All the threads waiting on @cond at the same time must
+ * use the same mutex.
+ *
+ * As with any condition variable, the condition waited for must be checked
+ * again once woken up, since another thread may have changed it first.
+ *
+ * Return: -1 if @cond or @mutex is NULL, or if @mutex is not taken by the
+ * calling thread. 0 once signaled, with @mutex taken.
+ */
+int uthread_cond_wait(uthread_cond_t cond, uthread_mutex_t mutex);
+
+/*
+ * uthread_cond_signal - Wake up a thread waiting on a condition variable
+ * @cond: Condition variable to signal
+ *
+ * The oldest thread waiting on @cond, if any, is moved to the line of its
+ * mutex, and runs again once it gets the mutex.
+ *
+ * Return: -1 if @cond is NULL. 0 otherwise.
+ */
+int uthread_cond_signal(uthread_cond_t cond);
+
+/*
+ * uthread_cond_broadcast - Wake up all the threads waiting on a condition
+ * variable
+ * @cond: Condition variable to signal
+ *
+ * Like uthread_cond_signal(), for all the threads waiting on @cond, which get
+ * the mutex one after the other in the order they started waiting.
+ *
+ * Return: -1 if @cond is NULL. 0 otherwise.
+ */
+int uthread_cond_broadcast(uthread_cond_t cond);
+
+#endif /* _UTHREAD_MUTEX_H */
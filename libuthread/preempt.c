@@ -1,49 +1,214 @@
+#define _GNU_SOURCE
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 #include "private.h"
 #include "uthread.h"
 
 /*
- * Frequency of preemption
+ * Default frequency of preemption
  * 100Hz is 100 times per second
  */
 #define HZ 100
 struct sigaction new_action; // Structure to define the new action for a signal
-struct sigaction old_action; // Structure to hold the previous action for SIGVTALRM
+struct sigaction old_action; // Structure to hold the previous action for the signal
 struct itimerval timer; // Structure to configure the timer
 
-// Signal handler function for SIGVTALRM
+// Preemption configuration, see uthread_set_timeslice()
+static unsigned long slice_us = 1000000 / HZ; // Time slice
+static uthread_clock_t slice_clock = UTHREAD_CLOCK_VIRTUAL; // Clock measuring it
+static bool tickless; // Only tick when other threads are ready
+
+static bool preempt_on; // Preemption started
+static int preempt_signo; // Signal raised by the timer
+static sigset_t preempt_set; // Set made of preempt_signo only
+static bool thread_timers; // Each worker has a POSIX timer of its own
+
+/*
+ * The rest of the state is per kernel thread: with the M:N scheduler, every
+ * worker gets its own timer, directed at itself, and its own critical section
+ * nesting.
+ */
+static __thread timer_t thread_timer; // Timer of the worker, if thread_timers
+static __thread sigset_t idle_mask; // Signal mask of the worker while idle
+static __thread volatile sig_atomic_t timer_armed; // Timer is ticking
+static __thread volatile sig_atomic_t contended; // Other threads are ready to run
+
+/*
+ * Critical sections don't touch the signal mask: they only bump a nesting
+ * counter, which the signal handler checks before yielding. A tick that hits a
+ * critical section is recorded as pending, and the yield is performed by the
+ * outermost preempt_enable().
+ */
+static __thread volatile sig_atomic_t preempt_count; // Nesting of preempt_disable()
+static __thread volatile sig_atomic_t preempt_pending; // Tick deferred by a critical section
+
+// Program the timer to tick every time slice, or stop it if @on is false
+static void timer_set(bool on)
+{
+	struct itimerspec spec = { { 0, 0 }, { 0, 0 } };
+
+	timer.it_interval.tv_sec = on ? slice_us / 1000000 : 0;
+	timer.it_interval.tv_usec = on ? slice_us % 1000000 : 0;
+	timer.it_value = timer.it_interval;
+	timer_armed = on;
+
+	if (thread_timers) {
+		spec.it_interval.tv_sec = timer.it_interval.tv_sec;
+		spec.it_interval.tv_nsec = timer.it_interval.tv_usec * 1000;
+		spec.it_value = spec.it_interval;
+		timer_settime(thread_timer, 0, &spec, NULL);
+	} else if (slice_clock == UTHREAD_CLOCK_VIRTUAL) {
+		setitimer(ITIMER_VIRTUAL, &timer, NULL);
+	} else {
+		setitimer(ITIMER_PROF, &timer, NULL);
+	}
+}
+
+// Create the timer of the calling worker, delivering the signal to it only
+static void timer_open(void)
+{
+	struct sigevent sev = { 0 };
+	// Per-process CPU time can't be split between workers, so their
+	// timers count their own CPU time instead
+	clockid_t clock = slice_clock == UTHREAD_CLOCK_MONOTONIC ?
+		CLOCK_MONOTONIC : CLOCK_THREAD_CPUTIME_ID;
+
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = preempt_signo;
+	sev._sigev_un._tid = gettid();
+	if (timer_create(clock, &sev, &thread_timer) < 0) {
+		perror("timer_create error");
+		exit(1);
+	}
+}
+
+// Leave the signal handler after a preemption, possibly on another worker
+static __attribute__((noinline)) void sighandler_leave(void)
+{
+	pthread_sigmask(SIG_BLOCK, &preempt_set, NULL);
+	preempt_count = 0;
+}
+
+// Signal handler function for the preemption timer
 void sighandler(int signum){
 
 	// Gets called when the alarm rings
-	if (signum == SIGVTALRM){
-		uthread_yield(); // Yield to the next ready thread
+	if (signum == preempt_signo){
+		if (tickless && !contended) {
+			// Nobody else to run, stop ticking until somebody is
+			timer_set(false);
+			return;
+		}
+		if (preempt_count) {
+			preempt_pending = 1; // Tick when leaving the critical section
+			return;
+		}
+		// Let the scheduler account for the tick, and keep running the
+		// current thread unless its time is up
+		preempt_count = 1;
+		if (!uthread_tick()) {
+			preempt_count = 0;
+			return;
+		}
+		// Yield to the next ready thread. The kernel blocks the signal
+		// while its handler runs, but the thread switched to must remain
+		// preemptible, so unblock it first. Once switched back, block it
+		// again until the handler returns (which restores the mask), so
+		// that ticks can't pile up signal frames on the stack. Only
+		// preemptions pay for these system calls, critical sections don't
+		//
+		// With the M:N scheduler, the thread may be resumed by another
+		// worker, so the per-worker state must not be accessed through
+		// addresses computed before the switch
+		pthread_sigmask(SIG_UNBLOCK, &preempt_set, NULL);
+		trace_uthread(TRACE_PREEMPT, uthread_current(), 0);
+		uthread_preempt();
+		sighandler_leave();
 	}
 }
 
-// Disable preemption by blocking SIGVTALRM signal
+int uthread_set_timeslice(unsigned long usec, uthread_clock_t clock,
+			  bool tickless_mode)
+{
+	if (usec == 0 || preempt_on)
+		return -1;
+	if (clock != UTHREAD_CLOCK_VIRTUAL && clock != UTHREAD_CLOCK_PROF &&
+	    clock != UTHREAD_CLOCK_MONOTONIC)
+		return -1;
+
+	slice_us = usec;
+	slice_clock = clock;
+	tickless = tickless_mode;
+	return 0;
+}
+
+// Get the signal mask for idle waits, without the timer signal
+const sigset_t *preempt_idle_mask(void)
+{
+	return preempt_on ? &idle_mask : NULL;
+}
+
+// Let the timer know whether other threads are waiting to run
+void preempt_contention(bool others_ready)
+{
+	contended = others_ready;
+	// In tickless mode, the timer only gets re-armed on demand
+	if (others_ready && preempt_on && !timer_armed)
+		timer_set(true);
+}
+
+// Disable preemption by entering a critical section
 void preempt_disable(void)
 {
-	/* Disable preemption by blocking SIGVTALRM signal */
-	sigset_t block_set;
-	sigemptyset(&block_set);
-	sigaddset(&block_set, SIGVTALRM);
-	sigprocmask(SIG_BLOCK, &block_set, NULL);
+	preempt_count++;
+	// Keep the accesses of the critical section after this point
+	atomic_signal_fence(memory_order_seq_cst);
 }
 
-// Enable preemption by unblocking SIGVTALRM signal
+// Enable preemption by leaving a critical section
 void preempt_enable(void)
 {
-	/* Enable preemption by unblocking SIGVTALRM signal */
-	sigset_t unblock_set;
-	sigemptyset(&unblock_set);
-	sigaddset(&unblock_set, SIGVTALRM);
-	sigprocmask(SIG_UNBLOCK, &unblock_set, NULL);
+	atomic_signal_fence(memory_order_seq_cst);
+	if (--preempt_count == 0 && preempt_pending) {
+		// A tick fired while preemption was disabled
+		bool expired;
+
+		preempt_pending = 0;
+		preempt_count = 1;
+		expired = uthread_tick();
+		preempt_count = 0;
+		if (expired) {
+			trace_uthread(TRACE_PREEMPT, uthread_current(), 0);
+			uthread_preempt();
+		}
+	}
+}
+
+// Save the critical section nesting of a thread being switched out
+int preempt_save(void)
+{
+	int depth = preempt_count;
+
+	// The thread switched to resumes inside its own critical section, and
+	// the switch itself consumes any pending tick
+	preempt_count = 1;
+	preempt_pending = 0;
+	return depth;
+}
+
+// Restore the critical section nesting of a thread switched back to
+void preempt_restore(int depth)
+{
+	preempt_count = depth;
 }
 
 // Start preemption
@@ -53,45 +218,78 @@ void preempt_start(bool do_preempt)
 	if (!do_preempt){
 		return; // Do nothing if do_preempt is false
 	}
-	
-	// Set up signal handler for SIGVTALRM
-    sigemptyset(&new_action.sa_mask);
+
+	switch (slice_clock) {
+	case UTHREAD_CLOCK_VIRTUAL:
+		preempt_signo = SIGVTALRM;
+		break;
+	case UTHREAD_CLOCK_PROF:
+		preempt_signo = SIGPROF;
+		break;
+	case UTHREAD_CLOCK_MONOTONIC:
+		preempt_signo = SIGALRM;
+		break;
+	}
+
+	// Set up signal handler for the timer signal
+	sigemptyset(&new_action.sa_mask);
 	new_action.sa_handler = sighandler;
-	new_action.sa_flags = 0;
+	new_action.sa_flags = SA_RESTART;
 
-	// Unblock SIGVTALRM signal
-	sigset_t unblock_set;
-	sigemptyset(&unblock_set);
-	sigaddset(&unblock_set, SIGVTALRM);
-	sigprocmask(SIG_UNBLOCK, &unblock_set, NULL);
+	// Unblock the timer signal
+	sigemptyset(&preempt_set);
+	sigaddset(&preempt_set, preempt_signo);
+	pthread_sigmask(SIG_UNBLOCK, &preempt_set, NULL);
 
 	// Register the signal handler
-	if (sigaction(SIGVTALRM, &new_action, &old_action) == -1) {
-        perror("sigaction error\n");
-        exit(1);
-    }
-
-	// Configure the timer for preemption
-	timer.it_interval.tv_sec = 0;
-	timer.it_interval.tv_usec = 1000000 / HZ;
-	timer.it_value.tv_sec = 0;
-	timer.it_value.tv_usec = 1000000 / HZ;
-
-	// Set the timer
-	if (setitimer(ITIMER_VIRTUAL, &timer, NULL) < 0){
-		perror("setitimer error");
+	if (sigaction(preempt_signo, &new_action, &old_action) == -1) {
+		perror("sigaction error\n");
 		exit(1);
 	}
+
+	// Interval timers are per process, so wall-clock time and multiple
+	// workers require POSIX timers
+	thread_timers = slice_clock == UTHREAD_CLOCK_MONOTONIC || uthread_parallel;
+	preempt_on = true;
+	preempt_start_worker();
 }
 
 // Stop preemption
 void preempt_stop(void)
 {
+	if (!preempt_on)
+		return;
+
 	/* Stop preemption and restore the previous signal action */
-    sigaction(SIGVTALRM, &old_action, NULL); // Restore previous signal action
-    timer.it_value.tv_sec = 0;
-    timer.it_value.tv_usec = 0;
-    timer.it_interval.tv_sec = 0;
-    timer.it_interval.tv_usec = 0;
-    setitimer(ITIMER_VIRTUAL, &timer, NULL); // Disable the timer
+	preempt_stop_worker(); // Disable the timer
+	sigaction(preempt_signo, &old_action, NULL); // Restore previous signal action
+	preempt_on = false;
+}
+
+// Start the timer of the calling worker
+void preempt_start_worker(void)
+{
+	if (!preempt_on)
+		return;
+
+	if (thread_timers)
+		timer_open();
+
+	pthread_sigmask(SIG_BLOCK, NULL, &idle_mask);
+	sigaddset(&idle_mask, preempt_signo);
+
+	// Set the timer, unless there is nothing to preempt for now
+	if (!tickless || contended)
+		timer_set(true);
+}
+
+// Stop the timer of the calling worker
+void preempt_stop_worker(void)
+{
+	if (!preempt_on)
+		return;
+
+	timer_set(false);
+	if (thread_timers)
+		timer_delete(thread_timer);
 }
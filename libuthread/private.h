@@ -10,9 +10,20 @@
 /**
  * Private context API
  */
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+#if !defined(__x86_64__) && !defined(__aarch64__)
 #include <ucontext.h>
+#endif
 
+#include "list.h"
 #include "uthread.h"
+#include "wheel.h"
 
 /*
  * uthread_ctx_t - User-level thread context
@@ -23,8 +34,18 @@
  * Such a context is initialized for the first time when creating a thread with
  * uthread_ctx_init(). Once initialized, it can be switched to with
  * uthread_ctx_switch().
+ *
+ * On x86-64 and aarch64, a context is only the saved stack pointer: the
+ * callee-saved registers are pushed on the thread's own stack when switching
+ * out. Other architectures fall back to a full ucontext_t.
  */
-typedef ucontext_t uthread_ctx_t;
+typedef struct uthread_ctx {
+#if defined(__x86_64__) || defined(__aarch64__)
+	void *sp;
+#else
+	ucontext_t uc;
+#endif
+} uthread_ctx_t;
 
 /*
  * uthread_ctx_switch - Switch between two execution contexts
@@ -34,32 +55,85 @@ typedef ucontext_t uthread_ctx_t;
  */
 void uthread_ctx_switch(uthread_ctx_t *prev, uthread_ctx_t *next);
 
+#if defined(__x86_64__) || defined(__aarch64__)
+/* Contexts can be moved between stacks, see uthread_ctx_switch_via() */
+#define UTHREAD_CTX_SWITCH_VIA
+
+/*
+ * uthread_ctx_switch_via - Switch between two contexts through a third stack
+ * @prev: Pointer to the execution context structure in which to save the
+ *	currently running thread
+ * @next: Pointer to the execution context structure to resume
+ * @top_of_stack: Pointer to the top of a stack segment, not used by any context
+ * @size: Size of the stack segment
+ * @func: Function to call in between, on that stack segment
+ * @arg: Argument to pass to @func
+ *
+ * Like uthread_ctx_switch(), except that @func gets called once @prev is saved,
+ * and before @next is loaded. Neither the stack of @prev nor the one of @next is
+ * in use meanwhile, which lets @func move their contents around (or initialize
+ * @next with uthread_ctx_init()). @func must not switch contexts itself.
+ */
+void uthread_ctx_switch_via(uthread_ctx_t *prev, uthread_ctx_t *next,
+			    void *top_of_stack, size_t size,
+			    void (*func)(void *), void *arg);
+#endif
+
+/*
+ * uthread_ctx_stack_size - Round up the size of a stack segment
+ * @size: Size requested, at least UTHREAD_STACK_MIN
+ *
+ * Return: Size of the stack segment uthread_ctx_alloc_stack() actually maps for
+ * @size bytes, to be passed to the other stack functions
+ */
+size_t uthread_ctx_stack_size(size_t size);
+
 /*
  * uthread_ctx_alloc_stack - Allocate stack segment
+ * @size: Size of the segment, as returned by uthread_ctx_stack_size()
+ *
+ * The stack segment is taken from the stack cache if possible, and otherwise
+ * freshly mapped with a guard page right below it. The cache belongs to the
+ * calling worker, and threads exiting put their stacks back into it, so this
+ * must be called with preemption disabled.
  *
  * Return: Pointer to the top of a valid stack segment, or NULL in case of
  * failure
  */
-void *uthread_ctx_alloc_stack(void);
+void *uthread_ctx_alloc_stack(size_t size);
 
 /*
  * uthread_ctx_destroy_stack - Deallocate stack segment
  * @top_of_stack: Address of stack to deallocate
+ * @size: Size of the segment
+ *
+ * The stack segment goes back to the stack cache, unless the cache is full. It
+ * must not be the stack currently in use. Like uthread_ctx_alloc_stack(), this
+ * must be called with preemption disabled.
  */
-void uthread_ctx_destroy_stack(void *top_of_stack);
+void uthread_ctx_destroy_stack(void *top_of_stack, size_t size);
 
 /*
  * uthread_ctx_init - Initialize a thread's execution context
  * @uctx: Pointer to thread context to initialize
  * @top_of_stack: Pointer to the top of a valid stack segment, as allocated by
- *	uthread_ctx_alloc_stack()
+ *	uthread_ctx_alloc_stack() or by the user
+ * @size: Size of the stack segment
  * @func: Function to be executed by the thread
  * @arg: Argument to pass to the thread
  *
  * Return: 0 if @uctx was properly initialized, or -1 in case of failure
  */
-int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
-					 uthread_func_t func, void *arg);
+int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack, size_t size,
+		     uthread_func_t func, void *arg);
+
+/*
+ * uthread_ctx_flush_stacks - Empty the stack cache
+ *
+ * The stack cache is per kernel thread: this releases all the stacks cached by
+ * the calling one, e.g. before a worker of the M:N scheduler terminates.
+ */
+void uthread_ctx_flush_stacks(void);
 
 
 /**
@@ -70,8 +144,9 @@ int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
  * preempt_start - Start thread preemption
  * @preempt: Enable preemption if true
  *
- * Configure a timer that must fire a virtual alarm at a frequency of 100 Hz and
- * setup a timer handler that forcefully yields the currently running thread.
+ * Configure a timer that fires every time slice (10 ms of virtual time by
+ * default, see uthread_set_timeslice()) and setup a timer handler that
+ * forcefully yields the currently running thread.
  *
  * If @preempt is false, don't start preemption; all the other functions from
  * the preemption API should then be ineffective.
@@ -82,30 +157,220 @@ void preempt_start(bool preempt);
  * preempt_stop - Stop thread preemption
  *
  * Restore previous timer configuration, and previous action associated to
- * virtual alarm signals.
+ * the timer signal.
  */
 void preempt_stop(void);
 
+/*
+ * preempt_start_worker - Start thread preemption on an additional worker
+ *
+ * With the M:N scheduler, every worker other than the original execution
+ * thread calls this function when starting, after preempt_start() was called.
+ * Each worker is preempted by a timer of its own.
+ */
+void preempt_start_worker(void);
+
+/*
+ * preempt_stop_worker - Stop thread preemption on an additional worker
+ */
+void preempt_stop_worker(void);
+
+/*
+ * preempt_idle_mask - Signal mask for idle workers
+ *
+ * An idle worker waiting for events in the kernel has nothing to preempt, so
+ * the timer signal must not interrupt its wait. To be passed to the waiting
+ * system call, which installs it atomically for the duration of the wait.
+ *
+ * Return: Signal mask of the calling worker with the timer signal blocked, or
+ * NULL if preemption is disabled
+ */
+const sigset_t *preempt_idle_mask(void);
+
+/*
+ * preempt_contention - Report whether other threads are ready to run
+ * @others_ready: True if at least one thread, besides the running one, is ready
+ *
+ * To be called when the number of ready threads goes from zero to one and back.
+ * In tickless mode, the timer gets stopped when it fires while @others_ready is
+ * false, and restarted as soon as @others_ready becomes true.
+ */
+void preempt_contention(bool others_ready);
+
 /*
  * preempt_enable - Enable preemption
+ *
+ * Leave a critical section entered with preempt_disable(). When leaving the
+ * outermost critical section while a timer tick was deferred, yield right away.
  */
 void preempt_enable(void);
 
 /*
  * preempt_disable - Disable preemption
+ *
+ * Enter a critical section, during which the timer handler doesn't yield.
+ * Critical sections can be nested, and don't involve any system call.
  */
 void preempt_disable(void);
 
+/*
+ * preempt_save - Save preemption state before switching threads
+ *
+ * To be called, with preemption disabled, right before switching to another
+ * thread, which then resumes with a nesting of exactly one critical section.
+ *
+ * Return: Critical section nesting of the thread being switched out
+ */
+int preempt_save(void);
+
+/*
+ * preempt_restore - Restore preemption state after switching threads
+ * @depth: Value returned by preempt_save() when the thread was switched out
+ */
+void preempt_restore(int depth);
+
+
+/**
+ * Private locking API
+ */
+
+/*
+ * uthread_parallel - Threads are run by more than one worker
+ *
+ * Set by uthread_run() when the M:N scheduler starts more than one worker (see
+ * uthread_set_workers()). Otherwise, all the threads run on the same kernel
+ * thread and spinlocks are not needed.
+ */
+extern bool uthread_parallel;
+
+/*
+ * spinlock_t - Lock protecting data shared by threads running on different
+ * workers
+ *
+ * A spinlock must only be held with preemption disabled, for short sections
+ * that don't block.
+ */
+typedef struct spinlock {
+	atomic_bool locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { false }
+
+static inline void spin_init(spinlock_t *lock)
+{
+	atomic_init(&lock->locked, false);
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+	unsigned int spins = 0;
+
+	if (!uthread_parallel)
+		return;
+
+	while (atomic_exchange_explicit(&lock->locked, true,
+					memory_order_acquire)) {
+		while (atomic_load_explicit(&lock->locked,
+					    memory_order_relaxed)) {
+			// The holder may have been descheduled by the kernel
+			if (++spins % 128 == 0)
+				sched_yield();
+#if defined(__x86_64__)
+			else
+				__builtin_ia32_pause();
+#elif defined(__aarch64__)
+			else
+				__asm__ __volatile__("yield");
+#endif
+		}
+	}
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+	if (uthread_parallel)
+		atomic_store_explicit(&lock->locked, false,
+				      memory_order_release);
+}
+
 
 /**
  * Private uthread API
  */
 
+/*
+ * state_t - Thread states
+ */
+typedef enum state
+{
+	running, // Thread is currently running
+	ready, // Thread is ready to run
+	blocked, // Thread is blocked
+	zombie, // Thread has terminated
+	unused // TCB is deallocated
+} state_t;
+
+/*
+ * Outcome of a wait with a timeout, see uthread_block_timeout(). The thread
+ * unblocking the waiting thread and the timer race to move it out of
+ * TIMEOUT_PENDING, and only the winner makes it ready.
+ */
+enum {
+	TIMEOUT_NONE, // Not waiting with a timeout
+	TIMEOUT_PENDING, // Waiting, with its timer running
+	TIMEOUT_CANCELED, // Unblocked before the deadline
+	TIMEOUT_EXPIRED, // Deadline passed first
+};
+
+struct sched;
+
 /*
  * uthread_tcb - Internal representation of threads called TCB (Thread Control
  * Block)
+ *
+ * @node links the thread in whichever queue it currently belongs to: the ready
+ * queue, the zombie queue, or the waiting list of a semaphore. A thread is never
+ * in more than one of them at a time.
+ *
+ * A terminated thread keeps its TCB, without its stack, in the zombie queue
+ * until it is joined or detached. Deallocated TCBs are recycled, through the
+ * free list of the scheduler they were deallocated on.
+ *
+ * A thread created with a shared stack has no stack of its own: it runs on the
+ * shared stack of its worker, and the part of the shared stack it uses is
+ * copied to @saved when another such thread needs it.
  */
-struct uthread_tcb;
+struct uthread_tcb
+{
+	state_t state; // State of the thread
+	void *stk; // Pointer to the thread's stack
+	size_t stk_size; // Size of the thread's stack
+	bool stk_user; // Stack provided by the user, not to be deallocated
+	uthread_ctx_t *ctx; // Pointer to the thread's context
+	uthread_ctx_t context; // Context, pointed to by ctx
+	struct list_head node; // Link in the queue the thread is in
+	unsigned int level; // Current priority level, 0 being the highest
+	unsigned int ticks; // Time slices used at the current level
+	spinlock_t lock; // Protects state, joiner and detached
+	struct uthread_tcb *joiner; // Thread waiting in uthread_join()
+	void *retval; // Value passed to uthread_exit()
+	bool detached; // Deallocated as soon as terminated
+	struct wheel_timer timer; // Deadline, while sleeping or waiting with a timeout
+	struct sched *timer_sched; // Worker whose wheel holds timer
+	atomic_int timeout; // State of the wait with a timeout, if any
+	size_t sem_wanted; // Resources waited for, while blocked on a semaphore
+	void *chan_elem; // Element to send or receive, while blocked on a channel
+	bool stk_shared; // Runs on the shared stack of its worker
+	void *saved; // Copy of its part of the shared stack, while not on it
+	size_t saved_size; // Bytes in saved
+	size_t saved_cap; // Bytes allocated for saved
+	uthread_func_t func; // Function to start on the shared stack, if not yet
+	void *arg; // Argument of func
+	uint32_t trace_id; // Identifier in the trace, see uthread_trace_dump()
+	uthread_stats_t stats; // Execution statistics
+	uint64_t since; // Time of the last state change, for stats
+	char name[UTHREAD_NAME_MAX]; // Name, for debugging
+};
 
 /*
  * uthread_current - Get currently running thread
@@ -116,8 +381,42 @@ struct uthread_tcb *uthread_current(void);
 
 /*
  * uthread_block - Block currently running thread
+ * @lock: Lock protecting the waiting list, or NULL
+ *
+ * Must be called with preemption disabled, after having put the current thread
+ * in the waiting list that will be used to unblock it. If not NULL, @lock must
+ * be held by the caller, and gets released once the thread is completely
+ * switched out, so that no other worker can resume it before.
+ */
+void uthread_block(spinlock_t *lock);
+
+/*
+ * uthread_block_timeout - Block currently running thread, up to some time
+ * @lock: Lock protecting the waiting list
+ * @ns: Maximum time to wait for, in nanoseconds
+ *
+ * Like uthread_block(), but the thread is also made ready again once @ns have
+ * passed, by the timer wheel of its worker. Threads unblocking it must call
+ * uthread_cancel_timeout() first.
+ *
+ * Return: 0 if unblocked. -1 if the time passed first, in which case the thread
+ * was removed from the waiting list, which it is linked in by its node, and
+ * @lock is held again.
  */
-void uthread_block(void);
+int uthread_block_timeout(spinlock_t *lock, uint64_t ns);
+
+/*
+ * uthread_cancel_timeout - Stop the timer of a waiting thread
+ * @uthread: TCB of thread about to be unblocked
+ *
+ * Must be called with preemption disabled and the lock of the waiting list of
+ * @uthread held, before removing @uthread from it. Always succeeds for threads
+ * blocked with uthread_block().
+ *
+ * Return: false if @uthread timed out already, in which case it must be left in
+ * the waiting list, and not be made ready. True otherwise.
+ */
+bool uthread_cancel_timeout(struct uthread_tcb *uthread);
 
 /*
  * uthread_unblock - Unblock thread
@@ -125,4 +424,249 @@ void uthread_block(void);
  */
 void uthread_unblock(struct uthread_tcb *uthread);
 
+/*
+ * uthread_wake - Make a blocked thread ready, without yielding to it
+ * @uthread: TCB of thread to wake up, or NULL
+ *
+ * Must be called with preemption disabled. Unlike uthread_unblock(), the
+ * current thread keeps running.
+ */
+void uthread_wake(struct uthread_tcb *uthread);
+
+/*
+ * uthread_handoff - Switch to a blocked thread right away
+ * @uthread: TCB of thread to switch to, or NULL
+ *
+ * Must be called with preemption disabled, by a thread. @uthread runs before
+ * the threads already ready, whatever their priority, and the current thread
+ * gets ready.
+ */
+void uthread_handoff(struct uthread_tcb *uthread);
+
+/*
+ * uthread_stack_addr - Locate data on the stack of a switched out thread
+ * @uthread: TCB of a thread that is not running
+ * @addr: Address of data on the stack of @uthread, or anywhere else
+ *
+ * Must be called with preemption disabled. The frames of a thread with a shared
+ * stack are copied elsewhere while another such thread runs, so its stack
+ * addresses can't be used to reach them in the meantime.
+ *
+ * Return: Where the data at @addr currently is, which is @addr itself unless it
+ * is in the copied frames of @uthread
+ */
+void *uthread_stack_addr(struct uthread_tcb *uthread, void *addr);
+
+/*
+ * uthread_wait_fd - Block until a file descriptor is ready for I/O
+ * @fd: File descriptor to wait for
+ * @events: EPOLLIN to wait until @fd is readable, EPOLLOUT until writable
+ *
+ * The currently running thread is parked in the epoll instance of its worker,
+ * which makes it ready again once @fd is. Only one thread at a time can wait for
+ * a given file descriptor.
+ *
+ * Return: -1 in case of failure, with errno set. 0 otherwise.
+ */
+int uthread_wait_fd(int fd, uint32_t events);
+
+/*
+ * uthread_io_uring - Use io_uring for I/O
+ *
+ * Set by uthread_set_io_uring(). Read by uthread_run() to give each worker a
+ * ring.
+ */
+extern bool uthread_io_uring;
+
+/*
+ * uthread_io_submit - Perform an operation through the ring of the worker
+ * @sqe: Submission entry describing the operation, except for its user_data
+ * @res: Result of the operation, as found in its completion entry
+ *
+ * The currently running thread is blocked until the operation completes. The
+ * operation is only submitted to the kernel at the next scheduling pass of the
+ * worker, along with the others queued in the meantime.
+ *
+ * Return: -1 if there is no ring, or if it is full, 0 once the operation
+ * completed
+ */
+int uthread_io_submit(const struct io_uring_sqe *sqe, int *res);
+
+/*
+ * uthread_preempt - Preempt the running thread
+ *
+ * Called by the preemption timer handler when uthread_tick() returns true. Like
+ * uthread_yield(), but the switch is accounted as a preemption in the
+ * statistics of the thread.
+ */
+void uthread_preempt(void);
+
+/*
+ * uthread_tick - Account a time slice to the running thread
+ *
+ * Called by the preemption timer handler, with preemption disabled, at every
+ * tick hitting a thread outside of critical sections (or when leaving the
+ * critical section a tick hit). Implements the multi-level feedback queue
+ * policy (see uthread_set_mlfq()).
+ *
+ * Return: True if the running thread must yield, because it used up its
+ * quantum or because a thread of higher priority is ready
+ */
+bool uthread_tick(void);
+
+/*
+ * uthread_switch_finish - Finish switching to a new thread
+ *
+ * To be called by a thread when it runs for the first time, before enabling
+ * preemption. Completes what the thread switched out left to do (see
+ * uthread_block()).
+ */
+void uthread_switch_finish(void);
+
+/**
+ * Private tracing API
+ */
+
+/*
+ * trace_type - Scheduler events
+ */
+enum trace_type {
+	TRACE_CREATE, // Thread created, with its name
+	TRACE_SWITCH, // Thread switched to, with the trace_id of the previous one
+	TRACE_BLOCK, // Thread blocked
+	TRACE_UNBLOCK, // Thread made ready again
+	TRACE_EXIT, // Thread terminated
+	TRACE_PREEMPT, // Thread preempted by the timer
+	TRACE_SEM_WAIT, // Thread blocked on a semaphore, with its address
+	TRACE_SEM_POST, // Semaphore released, with its address
+	TRACE_MUTEX_WAIT, // Thread blocked on a mutex, with its address
+	TRACE_CHAN_WAIT, // Thread blocked on a channel, with its address
+};
+
+/*
+ * trace_record - Event in the trace of a worker
+ */
+struct trace_record {
+	uint64_t time; // Timestamp counter
+	uint32_t type; // One of trace_type
+	uint32_t uthread; // trace_id of the thread concerned
+	union {
+		uint64_t arg; // Argument of the event
+		char name[UTHREAD_NAME_MAX]; // Name, for TRACE_CREATE
+	};
+};
+
+/*
+ * trace_ring - Trace of a worker
+ *
+ * Records are only written by the worker, which overwrites the oldest ones once
+ * the ring is full, so writing one takes no lock nor atomic read-modify-write.
+ * The trace points all run with preemption disabled, except for TRACE_PREEMPT,
+ * which is written by the timer handler only when it interrupts none of them.
+ */
+struct trace_ring {
+	struct trace_record *records; // Power of two of them
+	uint64_t mask; // Number of records - 1
+	_Atomic uint64_t head; // Number of records written so far
+};
+
+#ifdef UTHREAD_TRACE
+#include <time.h>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+/* Trace of the calling worker, NULL if tracing is disabled */
+extern __thread struct trace_ring *trace_ring;
+
+/*
+ * trace_clock - Read the timestamp counter
+ *
+ * Return: Time stamp counter on x86-64, virtual counter on aarch64, or
+ * CLOCK_MONOTONIC in nanoseconds elsewhere
+ */
+static inline uint64_t trace_clock(void)
+{
+#if defined(__x86_64__)
+	return __rdtsc();
+#elif defined(__aarch64__)
+	uint64_t cnt;
+
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(cnt));
+	return cnt;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/*
+ * trace_event - Record a scheduler event
+ * @type: Type of event
+ * @uthread: trace_id of the thread concerned
+ * @arg: Argument of the event
+ */
+static inline void trace_event(enum trace_type type, uint32_t uthread,
+			       uint64_t arg)
+{
+	struct trace_ring *ring = trace_ring;
+	struct trace_record *record;
+	uint64_t head;
+
+	if (ring == NULL)
+		return;
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	record = &ring->records[head & ring->mask];
+	record->time = trace_clock();
+	record->type = type;
+	record->uthread = uthread;
+	record->arg = arg;
+	// Readers check head again after copying, see uthread_trace_dump()
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/*
+ * trace_create - Record the creation of a thread
+ * @uthread: TCB of the new thread, whose name is set
+ *
+ * Gives the thread its trace_id.
+ */
+void trace_create(struct uthread_tcb *uthread);
+
+/*
+ * trace_start - Allocate the traces of the workers
+ * @workers: Number of workers
+ *
+ * Called by uthread_run(), which discards the traces of its previous call.
+ */
+void trace_start(unsigned int workers);
+
+/*
+ * trace_start_worker - Start tracing the events of the calling worker
+ * @id: Index of the worker
+ */
+void trace_start_worker(unsigned int id);
+
+/*
+ * trace_stop_worker - Stop tracing the events of the calling worker
+ *
+ * The trace is kept for uthread_trace_dump().
+ */
+void trace_stop_worker(void);
+
+#define trace_uthread(type, uthread, arg) \
+	trace_event(type, (uthread)->trace_id, arg)
+#else
+/* Without UTHREAD_TRACE, the trace points compile to nothing */
+#define trace_event(type, uthread, arg) do { } while (0)
+#define trace_uthread(type, uthread, arg) do { } while (0)
+#define trace_create(uthread) do { } while (0)
+#define trace_start(workers) do { } while (0)
+#define trace_start_worker(id) do { } while (0)
+#define trace_stop_worker() do { } while (0)
+#endif /* UTHREAD_TRACE */
+
 #endif /* _UTHREAD_PRIVATE_H */
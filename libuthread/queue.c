@@ -8,6 +8,7 @@
 struct queue_node {
 	void *data;
 	struct queue_node *next;
+	struct queue_node *prev;
 };
 
 
@@ -28,6 +29,12 @@ queue_t queue_create(void) {
 	return my_queue;
 }
 
+queue_t queue_create_with_capacity(size_t capacity) {
+	// nodes are allocated one by one, nothing to reserve
+	(void)capacity;
+	return queue_create();
+}
+
 int queue_destroy(queue_t queue) {
 	if(queue == NULL || queue->size != 0){
 		return -1;
@@ -37,7 +44,7 @@ int queue_destroy(queue_t queue) {
 	return 0;
 }
 
-int queue_enqueue(queue_t queue, void *data) {
+int queue_enqueue_handle(queue_t queue, void *data, queue_node_t *handle) {
 	if(queue == NULL || data == NULL) {
 		return -1;
 	}
@@ -47,6 +54,7 @@ int queue_enqueue(queue_t queue, void *data) {
 	}
 	my_queue_node->data = data;
 	my_queue_node->next = NULL;
+	my_queue_node->prev = queue->tail;
 
 	if(queue->size == 0) {
 		queue->head = my_queue_node;
@@ -56,9 +64,16 @@ int queue_enqueue(queue_t queue, void *data) {
 		queue->tail = my_queue_node;
 	}
 	queue->size++;
+	if(handle != NULL) {
+		*handle = my_queue_node;
+	}
 	return 0;
 }
 
+int queue_enqueue(queue_t queue, void *data) {
+	return queue_enqueue_handle(queue, data, NULL);
+}
+
 int queue_dequeue(queue_t queue, void **data) {
 	if(queue == NULL || data == NULL || queue->size == 0) {
 		return -1;
@@ -66,58 +81,67 @@ int queue_dequeue(queue_t queue, void **data) {
 	*data = queue->head->data;
 	queue_node_t temp = queue->head;
 	queue->head = queue->head->next;
+	if(queue->head != NULL) {
+		queue->head->prev = NULL;
+	} else {
+		queue->tail = NULL;
+	}
 	free(temp);
 	queue->size--;
 	return 0;
 }
 
+// unlink @node from @queue and free it, in O(1) thanks to the back links
+static void queue_unlink(queue_t queue, queue_node_t node) {
+	if(node->prev != NULL) {
+		node->prev->next = node->next;
+	} else {
+		queue->head = node->next;
+	}
+	if(node->next != NULL) {
+		node->next->prev = node->prev;
+	} else {
+		queue->tail = node->prev;
+	}
+	free(node);
+	queue->size--;
+}
+
 int queue_delete(queue_t queue, void *data) {
 	if(queue == NULL || data == NULL || queue->size == 0) {
 		return -1;
 	}
 	queue_node_t curr_node = queue->head;
-	queue_node_t prev = NULL;
 
 	while(curr_node != NULL) {
 		if(curr_node->data == data) {
-			queue->size--;
-			break;
+			queue_unlink(queue, curr_node);
+			return 0;
 		}
-		prev = curr_node;
 		curr_node = curr_node->next;
 	}
-
-	if(queue->head == curr_node && queue->tail == curr_node) {
-		queue->head = NULL;
-		queue->tail = NULL;
-		free(curr_node);
-		return 0;
-	}else if(queue->head == curr_node) {
-		queue->head = curr_node->next;
-		free(curr_node);
-		return 0;
-	}else if(queue->tail == curr_node) {
-		queue->tail = prev;
-		queue->tail->next = NULL;
-		free(curr_node);
-		return 0;
-	}else if(curr_node != NULL) {
-		prev->next = curr_node->next;
-		free(curr_node);
-		return 0;
-	}
-	// other unexpected condition
+	// data not found
 	return -1;
 }
 
+int queue_delete_handle(queue_t queue, queue_node_t handle) {
+	if(queue == NULL || handle == NULL || queue->size == 0) {
+		return -1;
+	}
+	queue_unlink(queue, handle);
+	return 0;
+}
+
 int queue_iterate(queue_t queue, queue_func_t func) {
 	if(queue == NULL || func == NULL) {
 		return -1;
 	}
 	queue_node_t curr_node = queue->head;
 	while(curr_node != NULL) {
+		// @func may delete the current node
+		queue_node_t next = curr_node->next;
 		(*func)(queue, curr_node->data);
-		curr_node = curr_node->next;
+		curr_node = next;
 	}
 	return 0;
 }
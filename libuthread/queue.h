@@ -1,6 +1,8 @@
 #ifndef _QUEUE_H
 #define _QUEUE_H
 
+#include <stddef.h>
+
 /*
  * queue_t - Queue type
  *
@@ -9,9 +11,18 @@
  * first and so on.
  *
  * Apart from delete and iterate operations, all operations should be O(1).
+ * Deleting an item by handle (see queue_enqueue_handle()) is O(1) as well.
  */
 typedef struct queue* queue_t;
+
+/*
+ * queue_node_t - Handle to an enqueued item
+ *
+ * Opaque reference to the position of an item in a queue, returned by
+ * queue_enqueue_handle().
+ */
 typedef struct queue_node* queue_node_t;
+
 /*
  * queue_create - Allocate an empty queue
  *
@@ -22,6 +33,20 @@ typedef struct queue_node* queue_node_t;
  */
 queue_t queue_create(void);
 
+/*
+ * queue_create_with_capacity - Allocate an empty queue with room for items
+ * @capacity: Number of items the queue should be able to hold without growing
+ *
+ * Same as queue_create(), but hint the queue implementation that about
+ * @capacity items are expected. Implementations that store the items in an
+ * array preallocate it, and never shrink it below @capacity. Other
+ * implementations may ignore @capacity.
+ *
+ * Return: Pointer to new empty queue. NULL in case of failure when allocating
+ * the new queue.
+ */
+queue_t queue_create_with_capacity(size_t capacity);
+
 /*
  * queue_destroy - Deallocate a queue
  * @queue: Queue to deallocate
@@ -45,6 +70,21 @@ int queue_destroy(queue_t queue);
  */
 int queue_enqueue(queue_t queue, void *data);
 
+/*
+ * queue_enqueue_handle - Enqueue data item and get a handle to it
+ * @queue: Queue in which to enqueue item
+ * @data: Address of data item to enqueue
+ * @handle: Address of handle where to receive the position of the item
+ *
+ * Same as queue_enqueue(), but also return in @handle a reference to the newly
+ * enqueued item, which can later be given to queue_delete_handle(). A handle is
+ * valid until its item is dequeued or deleted. @handle may be NULL.
+ *
+ * Return: -1 if @queue or @data are NULL, or in case of memory allocation error
+ * when enqueing. 0 if @data was successfully enqueued in @queue.
+ */
+int queue_enqueue_handle(queue_t queue, void *data, queue_node_t *handle);
+
 /*
  * queue_dequeue - Dequeue data item
  * @queue: Queue in which to dequeue item
@@ -71,6 +111,20 @@ int queue_dequeue(queue_t queue, void **data);
  */
 int queue_delete(queue_t queue, void *data);
 
+/*
+ * queue_delete_handle - Delete data item by handle
+ * @queue: Queue in which to delete item
+ * @handle: Handle of the item, as returned by queue_enqueue_handle()
+ *
+ * Delete the item referred to by @handle from queue @queue, in O(1) regardless
+ * of its position in the queue. @handle must have been obtained from @queue.
+ *
+ * Return: -1 if @queue or @handle are NULL, or if the item was already removed
+ * from the queue (as far as the implementation can tell). 0 if the item was
+ * deleted from @queue.
+ */
+int queue_delete_handle(queue_t queue, queue_node_t handle);
+
 /*
  * queue_func_t - Queue callback function type
  * @queue: Queue to which item belongs
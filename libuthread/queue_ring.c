@@ -0,0 +1,352 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "queue.h"
+// sequence queue: items are stored in a circular array
+
+/* Default capacity of a queue (must be a power of two) */
+#define QUEUE_RING_CAPACITY 16
+
+/* Handle table entry of the items enqueued without a handle */
+#define QUEUE_RING_NO_ID SIZE_MAX
+
+/* Handles hold a handle table entry in their low half, a generation above */
+#define QUEUE_RING_ID_BITS (sizeof(uintptr_t) * 4)
+#define QUEUE_RING_ID_MASK (((uintptr_t)1 << QUEUE_RING_ID_BITS) - 1)
+
+/*
+ * Deleted items are not moved out of the array right away but left as NULL
+ * slots (data items are never NULL), which are skipped and reclaimed once they
+ * reach the head of the queue. Once they take up more than half of the array,
+ * or when the array is resized, the remaining items are packed together, unless
+ * the queue is being iterated over. Every slot has a sequence number, from
+ * which its position in the array is found in O(1).
+ *
+ * Handles refer to an entry of a handle table, which holds the sequence number
+ * of their item, updated when items are packed together, and a generation,
+ * bumped when the item leaves the queue so that stale handles are told apart.
+ * The entries of the items are kept in an array alongside theirs, only
+ * allocated once a handle is asked for.
+ */
+struct queue_handle {
+	size_t seq;		// sequence number of the item, next free if free
+	size_t gen;		// number of items that had this entry before
+};
+
+struct queue {
+	void **items;		// circular array of items
+	size_t mask;		// capacity - 1, capacity being a power of two
+	size_t head;		// index of the oldest slot
+	size_t used;		// slots in use, including deleted items
+	size_t head_seq;	// sequence number of the oldest slot
+	size_t min_capacity;	// the array never shrinks below this
+	int size;		// number of items
+	int iterating;		// nesting depth of queue_iterate()
+	size_t *ids;		// handle table entries of the items, if any
+	struct queue_handle *handles; // handle table
+	size_t nhandles;	// entries of the handle table ever used
+	size_t handles_capacity; // entries of the handle table
+	size_t free_handle;	// first free entry, QUEUE_RING_NO_ID if none
+};
+
+// index of the @i-th oldest slot
+static inline size_t queue_slot(queue_t queue, size_t i) {
+	return (queue->head + i) & queue->mask;
+}
+
+// move the slots into a new array of @capacity slots, oldest slot first,
+// leaving the deleted items behind unless the queue is being iterated over
+static int queue_resize(queue_t queue, size_t capacity) {
+	void **items = malloc(capacity * sizeof(void *));
+	size_t *ids = NULL;
+	if(items == NULL) {
+		return -1;
+	}
+	if(queue->ids != NULL) {
+		ids = malloc(capacity * sizeof(size_t));
+		if(ids == NULL) {
+			free(items);
+			return -1;
+		}
+	}
+	size_t used = 0;
+	if(ids == NULL &&
+	   (queue->iterating || queue->used == (size_t)queue->size)) {
+		// nothing to leave behind or renumber
+		for(; used < queue->used; used++) {
+			items[used] = queue->items[queue_slot(queue, used)];
+		}
+	} else {
+		for(size_t i = 0; i < queue->used; i++) {
+			size_t slot = queue_slot(queue, i);
+			void *data = queue->items[slot];
+			if(data == NULL && !queue->iterating) {
+				continue;
+			}
+			if(ids != NULL) {
+				size_t id = queue->ids[slot];
+				if(data != NULL && id != QUEUE_RING_NO_ID) {
+					queue->handles[id].seq =
+						queue->head_seq + used;
+				}
+				ids[used] = id;
+			}
+			items[used++] = data;
+		}
+	}
+	free(queue->items);
+	free(queue->ids);
+	queue->items = items;
+	queue->ids = ids;
+	queue->mask = capacity - 1;
+	queue->head = 0;
+	queue->used = used;
+	return 0;
+}
+
+// pack the items together once deleted items take up half of the array, and
+// shrink it if it is mostly empty
+static void queue_compact(queue_t queue) {
+	size_t capacity = queue->mask + 1;
+	if(queue->iterating || queue->used - queue->size <= capacity / 2) {
+		return;
+	}
+	while(capacity > queue->min_capacity &&
+	      (size_t)queue->size <= capacity / 4) {
+		capacity /= 2;
+	}
+	// if packing fails, just keep the deleted items for now
+	queue_resize(queue, capacity);
+}
+
+// get a handle table entry for the item of sequence number @seq
+static int queue_handle_alloc(queue_t queue, size_t seq, size_t *id) {
+	if(queue->ids == NULL) {
+		queue->ids = malloc((queue->mask + 1) * sizeof(size_t));
+		if(queue->ids == NULL) {
+			return -1;
+		}
+		for(size_t i = 0; i < queue->used; i++) {
+			queue->ids[queue_slot(queue, i)] = QUEUE_RING_NO_ID;
+		}
+	}
+	if(queue->free_handle == QUEUE_RING_NO_ID) {
+		if(queue->nhandles == queue->handles_capacity) {
+			size_t capacity = queue->handles_capacity * 2;
+			if(capacity == 0) {
+				capacity = QUEUE_RING_CAPACITY;
+			}
+			// entries must fit in handles, which must not be NULL
+			if(capacity > QUEUE_RING_ID_MASK) {
+				return -1;
+			}
+			struct queue_handle *handles = realloc(queue->handles,
+				capacity * sizeof(*handles));
+			if(handles == NULL) {
+				return -1;
+			}
+			queue->handles = handles;
+			queue->handles_capacity = capacity;
+		}
+		queue->handles[queue->nhandles].seq = QUEUE_RING_NO_ID;
+		queue->handles[queue->nhandles].gen = 0;
+		queue->free_handle = queue->nhandles++;
+	}
+	*id = queue->free_handle;
+	queue->free_handle = queue->handles[*id].seq;
+	queue->handles[*id].seq = seq;
+	return 0;
+}
+
+// empty slot @slot, giving back its handle table entry
+static inline void *queue_slot_clear(queue_t queue, size_t slot) {
+	void *data = queue->items[slot];
+	if(queue->ids != NULL && queue->ids[slot] != QUEUE_RING_NO_ID) {
+		size_t id = queue->ids[slot];
+		queue->handles[id].gen++;
+		queue->handles[id].seq = queue->free_handle;
+		queue->free_handle = id;
+	}
+	queue->items[slot] = NULL;
+	queue->size--;
+	return data;
+}
+
+// reclaim the deleted items at the head of the queue
+static void queue_skip_deleted(queue_t queue) {
+	while(queue->used > 0 && queue->items[queue->head] == NULL) {
+		queue->head = queue_slot(queue, 1);
+		queue->head_seq++;
+		queue->used--;
+	}
+}
+
+queue_t queue_create_with_capacity(size_t capacity) {
+	size_t real_capacity = QUEUE_RING_CAPACITY;
+	while(real_capacity < capacity) {
+		real_capacity <<= 1;
+		if(real_capacity == 0) {
+			return NULL;
+		}
+	}
+
+	queue_t my_queue = (queue_t)malloc(sizeof(struct queue));
+	if(my_queue == NULL) {
+		return NULL;
+	}
+	my_queue->items = malloc(real_capacity * sizeof(void *));
+	if(my_queue->items == NULL) {
+		free(my_queue);
+		return NULL;
+	}
+	my_queue->mask = real_capacity - 1;
+	my_queue->head = 0;
+	my_queue->used = 0;
+	my_queue->head_seq = 0;
+	my_queue->min_capacity = real_capacity;
+	my_queue->ids = NULL;
+	my_queue->handles = NULL;
+	my_queue->nhandles = 0;
+	my_queue->handles_capacity = 0;
+	my_queue->free_handle = QUEUE_RING_NO_ID;
+	my_queue->iterating = 0;
+	my_queue->size = 0;
+	return my_queue;
+}
+
+queue_t queue_create(void) {
+	return queue_create_with_capacity(QUEUE_RING_CAPACITY);
+}
+
+int queue_destroy(queue_t queue) {
+	if(queue == NULL || queue->size != 0){
+		return -1;
+	}
+	free(queue->items);
+	free(queue->ids);
+	free(queue->handles);
+	free(queue);
+	return 0;
+}
+
+int queue_enqueue_handle(queue_t queue, void *data, queue_node_t *handle) {
+	if(queue == NULL || data == NULL) {
+		return -1;
+	}
+	// full: double the capacity, which is amortised O(1) per enqueue
+	if(queue->used == queue->mask + 1) {
+		if(queue_resize(queue, (queue->mask + 1) * 2)) {
+			return -1;
+		}
+	}
+	size_t slot = queue_slot(queue, queue->used);
+	if(handle != NULL) {
+		size_t id;
+		if(queue_handle_alloc(queue, queue->head_seq + queue->used, &id)) {
+			return -1;
+		}
+		queue->ids[slot] = id;
+		// offset by one so that no handle is NULL
+		uintptr_t gen = queue->handles[id].gen & QUEUE_RING_ID_MASK;
+		*handle = (queue_node_t)((gen << QUEUE_RING_ID_BITS | id) + 1);
+	} else if(queue->ids != NULL) {
+		queue->ids[slot] = QUEUE_RING_NO_ID;
+	}
+	queue->items[slot] = data;
+	queue->used++;
+	queue->size++;
+	return 0;
+}
+
+int queue_enqueue(queue_t queue, void *data) {
+	return queue_enqueue_handle(queue, data, NULL);
+}
+
+int queue_dequeue(queue_t queue, void **data) {
+	if(queue == NULL || data == NULL || queue->size == 0) {
+		return -1;
+	}
+	*data = queue_slot_clear(queue, queue->head);
+	queue_skip_deleted(queue);
+
+	// a quarter full: halve the capacity, unless it was reserved at creation
+	size_t capacity = queue->mask + 1;
+	if(capacity > queue->min_capacity && queue->used <= capacity / 4) {
+		// if shrinking fails, just keep the bigger array
+		queue_resize(queue, capacity / 2);
+	}
+	return 0;
+}
+
+// delete the item of the @i-th oldest slot
+static void queue_delete_slot(queue_t queue, size_t i) {
+	queue_slot_clear(queue, queue_slot(queue, i));
+	if(i == 0) {
+		queue_skip_deleted(queue);
+	}
+	queue_compact(queue);
+}
+
+int queue_delete(queue_t queue, void *data) {
+	if(queue == NULL || data == NULL || queue->size == 0) {
+		return -1;
+	}
+	for(size_t i = 0; i < queue->used; i++) {
+		if(queue->items[queue_slot(queue, i)] == data) {
+			queue_delete_slot(queue, i);
+			return 0;
+		}
+	}
+	// data not found
+	return -1;
+}
+
+int queue_delete_handle(queue_t queue, queue_node_t handle) {
+	if(queue == NULL || handle == NULL || queue->size == 0) {
+		return -1;
+	}
+	uintptr_t value = (uintptr_t)handle - 1;
+	size_t id = value & QUEUE_RING_ID_MASK;
+	// stale handles are of an older generation of their entry
+	if(id >= queue->nhandles || (queue->handles[id].gen &
+	   QUEUE_RING_ID_MASK) != value >> QUEUE_RING_ID_BITS) {
+		return -1;
+	}
+	queue_delete_slot(queue, queue->handles[id].seq - queue->head_seq);
+	return 0;
+}
+
+int queue_iterate(queue_t queue, queue_func_t func) {
+	if(queue == NULL || func == NULL) {
+		return -1;
+	}
+	// @func may delete items, but slots of remaining items do not move until
+	// the iteration is over
+	queue->iterating++;
+	size_t seq = queue->head_seq;
+	while(1) {
+		// deleting at the head reclaims slots, possibly past @seq
+		if(seq < queue->head_seq) {
+			seq = queue->head_seq;
+		}
+		if(seq - queue->head_seq >= queue->used) {
+			break;
+		}
+		void *data = queue->items[queue_slot(queue, seq - queue->head_seq)];
+		if(data != NULL) {
+			(*func)(queue, data);
+		}
+		seq++;
+	}
+	queue->iterating--;
+	queue_compact(queue);
+	return 0;
+}
+
+int queue_length(queue_t queue) {
+	if(queue == NULL) {
+		return -1;
+	}
+	return queue->size;
+}
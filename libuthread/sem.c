@@ -1,91 +1,248 @@
+#include <errno.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include "queue.h"
 #include "sem.h"
 #include "private.h"
 #include "uthread.h"
 
 struct semaphore {
+    spinlock_t lock; // Protects the rest, when threads run on several workers
     size_t count;
-    queue_t waiting_threads;
+    struct list_head waiting_threads;
+    sem_wake_t wake; // What sem_up() does with the thread it unblocks
 };
 
-// void iterate_sem(queue_t queue, void* data) {
-//     sem_t sem = (sem_t)data;
-//     printf("%d\n",sem->count);
-//     queue_iterate(sem->waiting_threads, iterate_uthread_tcb);
-// }
-
 sem_t sem_create(size_t count) {
     sem_t semaphore = (sem_t)malloc(sizeof(struct semaphore));
     if (semaphore == NULL) {
         return NULL;
     }
 
+    spin_init(&semaphore->lock);
     semaphore->count = count;
-    semaphore->waiting_threads = queue_create();
-    if (semaphore->waiting_threads == NULL) {
-        free(semaphore);
-        return NULL;
-    }
+    list_init(&semaphore->waiting_threads);
+    semaphore->wake = SEM_WAKE_YIELD;
 
     return semaphore;
 }
 
+int sem_set_wake(sem_t sem, sem_wake_t wake) {
+    if (sem == NULL) {
+        return -1;
+    }
+    if (wake != SEM_WAKE_YIELD && wake != SEM_WAKE_CONTINUE &&
+        wake != SEM_WAKE_HANDOFF) {
+        return -1;
+    }
+
+    sem->wake = wake;
+    return 0;
+}
+
 int sem_destroy(sem_t sem) {
     if (sem == NULL) {
         return -1;
     }
 
-    if (queue_length(sem->waiting_threads) != 0) {
+    if (!list_empty(&sem->waiting_threads)) {
         return -1;
     }
 
-    queue_destroy(sem->waiting_threads);
     free(sem);
     return 0;
 }
 
+/*
+ * Hand resources over to the oldest waiting threads of @sem, as long as there
+ * are enough for the next one in line, and move them to @woken. If @all, move
+ * all the waiting threads instead, without changing the count. Called with the
+ * lock held
+ */
+static void sem_grant(sem_t sem, struct list_head *woken, bool all) {
+    struct list_head *node, *next;
+
+    list_for_each_safe(node, next, &sem->waiting_threads) {
+        struct uthread_tcb *waiting_thread =
+            list_entry(node, struct uthread_tcb, node);
+
+        if (!all && waiting_thread->sem_wanted > sem->count) {
+            break;
+        }
+        // Threads that just timed out leave the line by themselves
+        if (!uthread_cancel_timeout(waiting_thread)) {
+            continue;
+        }
+        if (!all) {
+            sem->count -= waiting_thread->sem_wanted;
+        }
+        list_del(node);
+        list_add_tail(node, woken);
+    }
+}
+
+/*
+ * Take @n resources from @sem, waiting for them for up to @ns if @timed, or
+ * forever otherwise. Return ETIMEDOUT if the time passed first
+ */
+static int sem_acquire(sem_t sem, size_t n, bool timed, uint64_t ns) {
+    struct list_head woken, *node;
+    struct uthread_tcb *self;
+
+    preempt_disable();
+    spin_lock(&sem->lock);
+    // Threads already waiting come first, even if there is enough for us,
+    // so that the ones waiting for more than what is left don't starve
+    if (list_empty(&sem->waiting_threads) && sem->count >= n) {
+        // Decrement the semaphore count and return success
+        sem->count -= n;
+        spin_unlock(&sem->lock);
+        preempt_enable();
+        return 0;
+    }
+    if (timed && ns == 0) {
+        spin_unlock(&sem->lock);
+        preempt_enable();
+        return ETIMEDOUT;
+    }
+
+    // Wait in line until sem_release() hands the resources over to us. Once
+    // given them, the semaphore is never accessed again, as the thread that
+    // released it may destroy it right away
+    self = uthread_current();
+    self->sem_wanted = n;
+    list_add_tail(&self->node, &sem->waiting_threads);
+    trace_uthread(TRACE_SEM_WAIT, self, (uintptr_t)sem);
+    self->stats.sem_waits++;
+    // Block the current thread; the lock is only released once we are
+    // switched out
+    if (!timed) {
+        uthread_block(&sem->lock);
+        preempt_enable();
+        return 0;
+    }
+    if (uthread_block_timeout(&sem->lock, ns) == 0) {
+        preempt_enable();
+        return 0;
+    }
+
+    // Timed out, and taken out of line: let the threads behind us have what
+    // we were waiting for
+    list_init(&woken);
+    sem_grant(sem, &woken, false);
+    spin_unlock(&sem->lock);
+    while ((node = list_pop(&woken)) != NULL) {
+        uthread_wake(list_entry(node, struct uthread_tcb, node));
+    }
+    preempt_enable();
+    return ETIMEDOUT;
+}
+
 int sem_down(sem_t sem) {
-    
+    return sem_down_n(sem, 1);
+}
+
+int sem_down_n(sem_t sem, size_t n) {
+    if (sem == NULL) {
+        return -1;
+    }
+
+    return sem_acquire(sem, n, false, 0);
+}
+
+int sem_trydown(sem_t sem) {
     if (sem == NULL) {
         return -1;
     }
 
     preempt_disable();
-    bool first_time = true;
-    while (sem->count == 0) {
-        if(first_time){
-            queue_enqueue(sem->waiting_threads, (void*)uthread_current());
-            first_time = false;
-        }
-        // Block the current thread until the semaphore becomes available
-        uthread_block();
-        // After unblocking, check if the semaphore is still not available
-        if (sem->count == 0) {
-            continue;
-        }
+    spin_lock(&sem->lock);
+    if (!list_empty(&sem->waiting_threads) || sem->count == 0) {
+        spin_unlock(&sem->lock);
+        preempt_enable();
+        return -1;
     }
-    // Decrement the semaphore count and return success
     sem->count--;
+    spin_unlock(&sem->lock);
     preempt_enable();
     return 0;
 }
 
-int sem_up(sem_t sem) {
+int sem_timeddown(sem_t sem, uint64_t ns) {
+    if (sem == NULL) {
+        return -1;
+    }
+
+    return sem_acquire(sem, 1, true, ns);
+}
+
+/*
+ * Release @n resources to @sem, and hand them over to the oldest waiting
+ * threads, as long as there are enough for the next one in line. If @all, wake
+ * up all the waiting threads instead, without changing the count. The threads
+ * woken up are rescheduled once, as configured by sem_set_wake()
+ */
+static int sem_release(sem_t sem, size_t n, bool all) {
+    struct list_head woken, *node;
+    struct uthread_tcb *first = NULL;
+    sem_wake_t wake;
+
     if (sem == NULL) {
         return -1;
     }
-    preempt_disable(); 
-    sem->count++;
-    // If there are waiting threads, unblock one
-    if (queue_length(sem->waiting_threads) > 0) {
-        struct uthread_tcb *waiting_thread;
-        queue_dequeue(sem->waiting_threads, (void **)&waiting_thread);
-        uthread_unblock(waiting_thread);
+
+    list_init(&woken);
+    preempt_disable();
+    spin_lock(&sem->lock);
+    if (n > SIZE_MAX - sem->count) {
+        spin_unlock(&sem->lock);
+        preempt_enable();
+        return -1;
+    }
+    sem->count += n;
+    sem_grant(sem, &woken, all);
+    wake = sem->wake;
+    spin_unlock(&sem->lock);
+    trace_uthread(TRACE_SEM_POST, uthread_current(), (uintptr_t)sem);
+
+    // The woken up threads may destroy the semaphore as soon as they run
+    node = list_pop(&woken);
+    if (node != NULL) {
+        first = list_entry(node, struct uthread_tcb, node);
+        if (wake != SEM_WAKE_HANDOFF) {
+            uthread_wake(first);
+        }
+    }
+    while ((node = list_pop(&woken)) != NULL) {
+        uthread_wake(list_entry(node, struct uthread_tcb, node));
+    }
+    if (first != NULL) {
+        switch (wake) {
+        case SEM_WAKE_YIELD:
+            uthread_yield();
+            break;
+        case SEM_WAKE_CONTINUE:
+            break;
+        case SEM_WAKE_HANDOFF:
+            uthread_handoff(first);
+            break;
+        }
     }
     preempt_enable();
 
     return 0;
 }
+
+int sem_up(sem_t sem) {
+    return sem_release(sem, 1, false);
+}
+
+int sem_up_n(sem_t sem, size_t n) {
+    return sem_release(sem, n, false);
+}
+
+int sem_broadcast(sem_t sem) {
+    return sem_release(sem, 0, true);
+}
@@ -1,6 +1,7 @@
 #ifndef _SEMAPHORE_H
 #define _SEMAPHORE_H
 
+#include <errno.h>
 #include <stdint.h>
 #include <sys/types.h>
 
@@ -15,6 +16,29 @@
  */
 typedef struct semaphore *sem_t;
 
+/*
+ * sem_wake_t - What sem_up() does after handing a semaphore over to a waiting
+ * thread
+ *
+ * SEM_WAKE_YIELD makes the waiting thread ready, then yields to the next ready
+ * thread. This is the default, and lets the woken up thread run soon, but costs
+ * a switch per release.
+ *
+ * SEM_WAKE_CONTINUE makes the waiting thread ready, and keeps running the
+ * caller. A producer releasing items in a loop keeps going until it blocks or
+ * gets preempted, and the consumers then catch up in a row.
+ *
+ * SEM_WAKE_HANDOFF switches to the waiting thread right away, ahead of the
+ * other ready threads, the caller becoming ready. Suits request/response
+ * patterns, where the caller has nothing else to do until the woken up thread
+ * answers.
+ */
+typedef enum {
+	SEM_WAKE_YIELD,
+	SEM_WAKE_CONTINUE,
+	SEM_WAKE_HANDOFF,
+} sem_wake_t;
+
 /*
  * sem_create - Create semaphore
  * @count: Semaphore count
@@ -37,6 +61,15 @@ sem_t sem_create(size_t count);
  */
 int sem_destroy(sem_t sem);
 
+/*
+ * sem_set_wake - Configure how a semaphore wakes up waiting threads
+ * @sem: Semaphore to configure
+ * @wake: Wake policy of sem_up() (see sem_wake_t)
+ *
+ * Return: -1 if @sem is NULL or @wake is invalid. 0 otherwise.
+ */
+int sem_set_wake(sem_t sem, sem_wake_t wake);
+
 /*
  * sem_down - Take a semaphore
  * @sem: Semaphore to take
@@ -50,6 +83,54 @@ int sem_destroy(sem_t sem);
  */
 int sem_down(sem_t sem);
 
+/*
+ * sem_down_n - Take several resources of a semaphore at once
+ * @sem: Semaphore to take
+ * @n: Number of resources to take
+ *
+ * Take @n resources from semaphore @sem, all at once: the caller thread is
+ * blocked until @n resources are available, and never holds only part of them.
+ *
+ * Threads are served in the order they started waiting. If threads are already
+ * waiting for @sem, the caller waits behind them even if enough resources are
+ * available, so that a thread waiting for many resources can't be starved by
+ * others taking fewer.
+ *
+ * Return: -1 if @sem is NULL. 0 if the @n resources were successfully taken.
+ */
+int sem_down_n(sem_t sem, size_t n);
+
+/*
+ * sem_trydown - Take a semaphore, if available
+ * @sem: Semaphore to take
+ *
+ * Like sem_down(), but fail right away instead of blocking, e.g. to shed load
+ * rather than pile up on a saturated resource. The semaphore is unavailable
+ * while other threads wait for it, even if its count isn't 0.
+ *
+ * Return: -1 if @sem is NULL or unavailable. 0 if semaphore was successfully
+ * taken.
+ */
+int sem_trydown(sem_t sem);
+
+/*
+ * sem_timeddown - Take a semaphore, waiting for it for a limited time
+ * @sem: Semaphore to take
+ * @ns: Maximum time to wait for, in nanoseconds
+ *
+ * Like sem_down(), but give up once @ns have passed, if the semaphore was not
+ * handed over in the meantime. The waiting thread is woken up by the timers of
+ * the scheduler, like uthread_sleep_ns(), and leaves the waiting list at once.
+ * If @ns is 0, fail right away if the semaphore is unavailable.
+ *
+ * The error is returned rather than set in errno, which belongs to the worker
+ * a thread runs on, and the thread may be moved to another one in between.
+ *
+ * Return: -1 if @sem is NULL. ETIMEDOUT if @ns passed first. 0 if semaphore was
+ * successfully taken.
+ */
+int sem_timeddown(sem_t sem, uint64_t ns);
+
 /*
  * sem_up - Release a semaphore
  * @sem: Semaphore to release
@@ -58,10 +139,39 @@ int sem_down(sem_t sem);
  *
  * If the waiting list associated to @sem is not empty, releasing a resource
  * also causes the first thread (i.e. the oldest) in the waiting list to be
- * unblocked.
+ * unblocked, as configured by sem_set_wake().
  *
  * Return: -1 if @sem is NULL. 0 if semaphore was successfully released.
  */
 int sem_up(sem_t sem);
 
+/*
+ * sem_up_n - Release several resources of a semaphore at once
+ * @sem: Semaphore to release
+ * @n: Number of resources to release
+ *
+ * Release @n resources to semaphore @sem. The resources are handed over to the
+ * threads in the waiting list, oldest first, as long as there are enough for
+ * the next one in line. All the threads unblocked are made ready at once, and
+ * the caller reschedules only once for all of them, as configured by
+ * sem_set_wake(); under SEM_WAKE_HANDOFF, the CPU goes to the oldest one.
+ *
+ * Return: -1 if @sem is NULL, or if the count of @sem would overflow. 0 if the
+ * resources were successfully released.
+ */
+int sem_up_n(sem_t sem, size_t n);
+
+/*
+ * sem_broadcast - Unblock all the threads waiting on a semaphore
+ * @sem: Semaphore to open
+ *
+ * Unblock all the threads in the waiting list of semaphore @sem, as if each one
+ * got the resources it waits for, without changing the count of @sem. Used as
+ * a gate: threads wait on a semaphore of count 0 until it opens for all of
+ * them. Threads unblocked are rescheduled once, as with sem_up_n().
+ *
+ * Return: -1 if @sem is NULL. 0 otherwise.
+ */
+int sem_broadcast(sem_t sem);
+
 #endif /* _SEMAPHORE_H */
@@ -0,0 +1,316 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "private.h"
+#include "uthread.h"
+
+#ifdef UTHREAD_TRACE
+/* Default number of records in the trace of each worker */
+#define TRACE_RECORDS 65536
+
+/* Largest number of records in the trace of each worker */
+#define TRACE_RECORDS_MAX (1UL << 28)
+
+__thread struct trace_ring *trace_ring;
+
+static size_t trace_size = TRACE_RECORDS; // Records per worker, 0 if disabled
+static struct trace_ring *rings; // Traces of the workers of the last run
+static unsigned int nrings; // Number of entries in rings
+static atomic_uint trace_ids; // Last trace_id given to a thread
+
+// Reference point to convert timestamps, taken when the traces start
+static uint64_t start_clock;
+static uint64_t start_ns;
+
+// Names of the events in the exported trace
+static const char *const trace_names[] = {
+	[TRACE_CREATE] = "create",
+	[TRACE_SWITCH] = "switch",
+	[TRACE_BLOCK] = "block",
+	[TRACE_UNBLOCK] = "unblock",
+	[TRACE_EXIT] = "exit",
+	[TRACE_PREEMPT] = "preempt",
+	[TRACE_SEM_WAIT] = "sem_wait",
+	[TRACE_SEM_POST] = "sem_post",
+	[TRACE_MUTEX_WAIT] = "mutex_wait",
+	[TRACE_CHAN_WAIT] = "chan_wait",
+};
+
+// Function to read CLOCK_MONOTONIC, in nanoseconds
+static uint64_t trace_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int uthread_set_trace(size_t records)
+{
+	size_t size = 1;
+
+	if (records > TRACE_RECORDS_MAX)
+		return -1;
+
+	while (size < records)
+		size <<= 1;
+	trace_size = records ? size : 0;
+	return 0;
+}
+
+void trace_create(struct uthread_tcb *uthread)
+{
+	struct trace_ring *ring = trace_ring;
+	struct trace_record *record;
+	uint64_t head;
+
+	uthread->trace_id = atomic_fetch_add_explicit(&trace_ids, 1,
+						      memory_order_relaxed) + 1;
+	if (ring == NULL)
+		return;
+
+	// Same as trace_event(), with the name as argument
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	record = &ring->records[head & ring->mask];
+	record->time = trace_clock();
+	record->type = TRACE_CREATE;
+	record->uthread = uthread->trace_id;
+	memcpy(record->name, uthread->name, UTHREAD_NAME_MAX);
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void trace_start(unsigned int workers)
+{
+	for (unsigned int i = 0; i < nrings; i++)
+		free(rings[i].records);
+	free(rings);
+	rings = NULL;
+	nrings = 0;
+	atomic_store(&trace_ids, 0);
+	if (trace_size == 0)
+		return;
+
+	// Tracing is best effort: workers whose trace can't be allocated just
+	// don't record anything
+	rings = calloc(workers, sizeof(*rings));
+	if (rings == NULL)
+		return;
+	nrings = workers;
+	for (unsigned int i = 0; i < workers; i++) {
+		rings[i].records = malloc(trace_size * sizeof(struct trace_record));
+		rings[i].mask = trace_size - 1;
+		atomic_init(&rings[i].head, 0);
+	}
+
+	start_clock = trace_clock();
+	start_ns = trace_ns();
+}
+
+void trace_start_worker(unsigned int id)
+{
+	trace_ring = id < nrings && rings[id].records != NULL ? &rings[id] : NULL;
+}
+
+void trace_stop_worker(void)
+{
+	trace_ring = NULL;
+}
+
+/*
+ * Function to copy the records of a trace, possibly while being written
+ *
+ * The records overwritten during the copy are left out, like the one that may
+ * be being written. Return the number of valid records in @copy, the oldest one
+ * being at index *@first (modulo the size of the ring).
+ */
+static size_t trace_snapshot(struct trace_ring *ring,
+			     struct trace_record *copy, uint64_t *first)
+{
+	uint64_t size = ring->mask + 1;
+	uint64_t last, head;
+
+	last = atomic_load_explicit(&ring->head, memory_order_acquire);
+	memcpy(copy, ring->records, size * sizeof(*copy));
+	atomic_thread_fence(memory_order_acquire);
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	*first = head + 1 > size ? head + 1 - size : 0;
+	return *first < last ? last - *first : 0;
+}
+
+// Function to write a string as a JSON string literal
+static void json_string(FILE *f, const char *s, size_t max)
+{
+	fputc('"', f);
+	for (size_t i = 0; i < max && s[i]; i++) {
+		unsigned char c = s[i];
+
+		if (c == '"' || c == '\\')
+			fprintf(f, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(f, "\\u%04x", c);
+		else
+			fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+// Function to write the name of a thread, as found in its TRACE_CREATE event
+static void json_uthread(FILE *f, char (*names)[UTHREAD_NAME_MAX],
+			 uint32_t nids, uint32_t uthread)
+{
+	char name[32];
+
+	if (uthread < nids && names[uthread][0] != '\0') {
+		json_string(f, names[uthread], UTHREAD_NAME_MAX);
+		return;
+	}
+	snprintf(name, sizeof(name), "uthread %u", uthread);
+	json_string(f, name, sizeof(name));
+}
+
+// Function to write a run of a thread on a worker, from @since to @until
+static void json_run(FILE *f, char (*names)[UTHREAD_NAME_MAX], uint32_t nids,
+		     unsigned int worker, uint32_t uthread, double since,
+		     double until)
+{
+	fprintf(f, ",\n{\"name\":");
+	json_uthread(f, names, nids, uthread);
+	fprintf(f, ",\"cat\":\"run\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+		"\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"uthread\":%u}}", worker,
+		since, until - since, uthread);
+}
+
+int uthread_trace_dump(const char *path)
+{
+	struct trace_record **copies;
+	uint64_t *firsts;
+	size_t *counts;
+	char (*names)[UTHREAD_NAME_MAX];
+	uint32_t nids = atomic_load(&trace_ids) + 1;
+	uint64_t ticks;
+	double us_per_tick;
+	FILE *f;
+	int ret = -1;
+
+	if (rings == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	// Calibrate the timestamp counter against the time elapsed since the
+	// traces started
+	ticks = trace_clock() - start_clock;
+	us_per_tick = (trace_ns() - start_ns) / 1000.0 / (ticks ? ticks : 1);
+
+	copies = calloc(nrings, sizeof(*copies));
+	firsts = calloc(nrings, sizeof(*firsts));
+	counts = calloc(nrings, sizeof(*counts));
+	names = calloc(nids, sizeof(*names));
+	f = fopen(path, "w");
+	if (copies == NULL || firsts == NULL || counts == NULL ||
+	    names == NULL || f == NULL)
+		goto out;
+
+	for (unsigned int i = 0; i < nrings; i++) {
+		if (rings[i].records == NULL)
+			continue;
+		copies[i] = malloc((rings[i].mask + 1) * sizeof(**copies));
+		if (copies[i] == NULL)
+			goto out;
+		counts[i] = trace_snapshot(&rings[i], copies[i], &firsts[i]);
+	}
+
+	// Threads may be created on one worker and run on another
+	for (unsigned int i = 0; i < nrings; i++) {
+		for (size_t j = 0; j < counts[i]; j++) {
+			struct trace_record *r =
+				&copies[i][(firsts[i] + j) & rings[i].mask];
+
+			if (r->type == TRACE_CREATE && r->uthread < nids)
+				memcpy(names[r->uthread], r->name,
+				       UTHREAD_NAME_MAX);
+		}
+	}
+
+	fprintf(f, "{\"traceEvents\":[\n");
+	fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+		"\"args\":{\"name\":\"uthread\"}}");
+	for (unsigned int i = 0; i < nrings; i++) {
+		uint32_t running = UINT32_MAX; // Unknown before the first switch
+		double since = 0, ts = 0;
+
+		fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+			"\"tid\":%u,\"args\":{\"name\":\"worker %u\"}}", i, i);
+
+		for (size_t j = 0; j < counts[i]; j++) {
+			struct trace_record *r =
+				&copies[i][(firsts[i] + j) & rings[i].mask];
+
+			ts = (r->time - start_clock) * us_per_tick;
+			if (r->type != TRACE_SWITCH) {
+				fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"i\","
+					"\"s\":\"t\",\"pid\":1,\"tid\":%u,"
+					"\"ts\":%.3f,\"args\":{\"uthread\":%u,"
+					"\"name\":", trace_names[r->type], i, ts,
+					r->uthread);
+				json_uthread(f, names, nids, r->uthread);
+				if (r->type == TRACE_SEM_WAIT ||
+				    r->type == TRACE_SEM_POST)
+					fprintf(f, ",\"sem\":\"%#llx\"",
+						(unsigned long long)r->arg);
+				else if (r->type == TRACE_MUTEX_WAIT)
+					fprintf(f, ",\"mutex\":\"%#llx\"",
+						(unsigned long long)r->arg);
+				else if (r->type == TRACE_CHAN_WAIT)
+					fprintf(f, ",\"chan\":\"%#llx\"",
+						(unsigned long long)r->arg);
+				fprintf(f, "}}");
+				continue;
+			}
+
+			// Each thread run is a slice, from the switch to it up
+			// to the next switch. The idle thread (0) is left out
+			if (running != UINT32_MAX && running != 0)
+				json_run(f, names, nids, i, running, since, ts);
+			running = r->uthread;
+			since = ts;
+		}
+		// The last run is cut at the last event
+		if (running != UINT32_MAX && running != 0 && ts > since)
+			json_run(f, names, nids, i, running, since, ts);
+	}
+	fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+	ret = ferror(f) ? -1 : 0;
+
+out:
+	if (f != NULL && fclose(f))
+		ret = -1;
+	for (unsigned int i = 0; copies != NULL && i < nrings; i++)
+		free(copies[i]);
+	free(copies);
+	free(firsts);
+	free(counts);
+	free(names);
+	return ret;
+}
+#else
+int uthread_set_trace(size_t records)
+{
+	(void)records;
+	errno = ENOSYS;
+	return -1;
+}
+
+int uthread_trace_dump(const char *path)
+{
+	(void)path;
+	errno = ENOSYS;
+	return -1;
+}
+#endif /* UTHREAD_TRACE */
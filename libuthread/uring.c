@@ -0,0 +1,202 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+struct uring {
+	int fd;				/* Ring instance */
+	unsigned int *sq_head;		/* Next entry consumed by the kernel */
+	unsigned int *sq_tail;		/* Next entry to queue */
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	unsigned int *sq_array;		/* Indexes into sqes */
+	struct io_uring_sqe *sqes;
+	unsigned int *cq_head;		/* Next completion to consume */
+	unsigned int *cq_tail;		/* Next completion posted by the kernel */
+	unsigned int cq_mask;
+	unsigned int cq_entries;
+	struct io_uring_cqe *cqes;
+	unsigned int pending;		/* Entries queued, not submitted yet */
+	void *sq_ring, *cq_ring;	/* Shared mappings */
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+};
+
+static int uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned int to_submit,
+		       unsigned int min_complete, unsigned int flags,
+		       const sigset_t *sigmask)
+{
+	/* The kernel expects the size of its own sigset_t */
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+		       sigmask, _NSIG / 8);
+}
+
+static int uring_register(int fd, unsigned int opcode, void *arg,
+			  unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void uring_unmap(struct uring *r)
+{
+	if (r->sqes != NULL && r->sqes != MAP_FAILED)
+		munmap(r->sqes, r->sqes_size);
+	if (r->cq_ring != NULL && r->cq_ring != MAP_FAILED &&
+	    r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_ring_size);
+	if (r->sq_ring != NULL && r->sq_ring != MAP_FAILED)
+		munmap(r->sq_ring, r->sq_ring_size);
+}
+
+struct uring *uring_open(unsigned int entries, int evfd)
+{
+	struct io_uring_params p;
+	struct uring *r;
+	int err;
+
+	r = calloc(1, sizeof(*r));
+	if (r == NULL)
+		return NULL;
+
+	memset(&p, 0, sizeof(p));
+	r->fd = uring_setup(entries, &p);
+	if (r->fd < 0) {
+		free(r);
+		return NULL;
+	}
+
+	/* Map the rings, which may share a single mapping */
+	r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_ring_size = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_ring_size > r->sq_ring_size)
+			r->sq_ring_size = r->cq_ring_size;
+		r->cq_ring_size = r->sq_ring_size;
+	}
+	r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ring == MAP_FAILED)
+		goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->cq_ring = r->sq_ring;
+	else
+		r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_POPULATE, r->fd,
+				  IORING_OFF_CQ_RING);
+	if (r->cq_ring == MAP_FAILED)
+		goto fail;
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		goto fail;
+
+	r->sq_head = (void *)((char *)r->sq_ring + p.sq_off.head);
+	r->sq_tail = (void *)((char *)r->sq_ring + p.sq_off.tail);
+	r->sq_mask = *(unsigned int *)((char *)r->sq_ring + p.sq_off.ring_mask);
+	r->sq_entries = p.sq_entries;
+	r->sq_array = (void *)((char *)r->sq_ring + p.sq_off.array);
+	r->cq_head = (void *)((char *)r->cq_ring + p.cq_off.head);
+	r->cq_tail = (void *)((char *)r->cq_ring + p.cq_off.tail);
+	r->cq_mask = *(unsigned int *)((char *)r->cq_ring + p.cq_off.ring_mask);
+	r->cq_entries = p.cq_entries;
+	r->cqes = (void *)((char *)r->cq_ring + p.cq_off.cqes);
+
+	if (evfd >= 0 &&
+	    uring_register(r->fd, IORING_REGISTER_EVENTFD, &evfd, 1) < 0)
+		goto fail;
+	return r;
+
+fail:
+	err = errno;
+	uring_unmap(r);
+	close(r->fd);
+	free(r);
+	errno = err;
+	return NULL;
+}
+
+void uring_close(struct uring *r)
+{
+	uring_unmap(r);
+	close(r->fd);
+	free(r);
+}
+
+unsigned int uring_capacity(struct uring *r)
+{
+	return r->cq_entries;
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *r)
+{
+	unsigned int head = atomic_load_explicit((_Atomic unsigned int *)r->sq_head,
+						 memory_order_acquire);
+	unsigned int tail = *r->sq_tail;
+	struct io_uring_sqe *sqe;
+
+	if (tail - head >= r->sq_entries)
+		return NULL;
+
+	sqe = &r->sqes[tail & r->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+void uring_queue(struct uring *r)
+{
+	unsigned int tail = *r->sq_tail;
+
+	r->sq_array[tail & r->sq_mask] = tail & r->sq_mask;
+	/* Publish the entry before the new tail */
+	atomic_store_explicit((_Atomic unsigned int *)r->sq_tail, tail + 1,
+			      memory_order_release);
+	r->pending++;
+}
+
+unsigned int uring_pending(struct uring *r)
+{
+	return r->pending;
+}
+
+int uring_submit(struct uring *r, bool wait, const sigset_t *sigmask)
+{
+	int ret;
+
+	ret = uring_enter(r->fd, r->pending, wait ? 1 : 0,
+			  wait ? IORING_ENTER_GETEVENTS : 0,
+			  wait ? sigmask : NULL);
+	if (ret < 0)
+		return -1;
+	r->pending -= ret;
+	return 0;
+}
+
+struct io_uring_cqe *uring_peek(struct uring *r)
+{
+	unsigned int head = *r->cq_head;
+	unsigned int tail = atomic_load_explicit((_Atomic unsigned int *)r->cq_tail,
+						 memory_order_acquire);
+
+	if (head == tail)
+		return NULL;
+	return &r->cqes[head & r->cq_mask];
+}
+
+void uring_seen(struct uring *r)
+{
+	/* Let the kernel reuse the entry once done reading it */
+	atomic_store_explicit((_Atomic unsigned int *)r->cq_head, *r->cq_head + 1,
+			      memory_order_release);
+}
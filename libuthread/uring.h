@@ -0,0 +1,98 @@
+#ifndef _UTHREAD_URING_H
+#define _UTHREAD_URING_H
+
+/*
+ * Minimal io_uring
+ *
+ * Submission and completion rings shared with the kernel, driven through the
+ * raw system calls so that no library is needed. Submission entries are only
+ * queued in memory until uring_submit() passes them all to the kernel with a
+ * single system call. Completions are collected from memory, without any.
+ *
+ * A ring is not thread-safe: only the worker owning it may use it.
+ *
+ * Like the rest of the private headers, this is only meant to be used within
+ * libuthread.
+ */
+
+#include <linux/io_uring.h>
+#include <signal.h>
+#include <stdbool.h>
+
+struct uring;
+
+/*
+ * uring_open - Set up a ring
+ * @entries: Number of submission entries, a power of two
+ * @evfd: Eventfd signaled at every completion, or -1
+ *
+ * Return: New ring, or NULL in case of failure (e.g. io_uring not supported by
+ * the kernel), with errno set
+ */
+struct uring *uring_open(unsigned int entries, int evfd);
+
+/*
+ * uring_close - Tear down a ring
+ * @r: Ring to tear down, without any operation in progress
+ */
+void uring_close(struct uring *r);
+
+/*
+ * uring_capacity - Number of operations that can be in progress at once
+ * @r: Ring to measure
+ *
+ * Return: Number of completions the ring can hold
+ */
+unsigned int uring_capacity(struct uring *r);
+
+/*
+ * uring_get_sqe - Reserve a submission entry
+ * @r: Ring to reserve from
+ *
+ * The entry must be filled, then queued with uring_queue().
+ *
+ * Return: Submission entry, or NULL if the submission ring is full
+ */
+struct io_uring_sqe *uring_get_sqe(struct uring *r);
+
+/*
+ * uring_queue - Queue the submission entry last reserved
+ * @r: Ring to queue to
+ */
+void uring_queue(struct uring *r);
+
+/*
+ * uring_pending - Number of queued submission entries
+ * @r: Ring to check
+ *
+ * Return: Number of entries queued and not yet submitted
+ */
+unsigned int uring_pending(struct uring *r);
+
+/*
+ * uring_submit - Submit the queued entries to the kernel
+ * @r: Ring to submit
+ * @wait: Also wait until at least one completion is available
+ * @sigmask: Signal mask while waiting, or NULL to keep the current one
+ *
+ * Return: -1 in case of failure (including interruption by a signal), with
+ * errno set, 0 otherwise
+ */
+int uring_submit(struct uring *r, bool wait, const sigset_t *sigmask);
+
+/*
+ * uring_peek - Get the oldest completion
+ * @r: Ring to get from
+ *
+ * Return: Oldest completion not yet consumed with uring_seen(), or NULL if there
+ * are none
+ */
+struct io_uring_cqe *uring_peek(struct uring *r);
+
+/*
+ * uring_seen - Consume the oldest completion
+ * @r: Ring to consume from, after uring_peek() returned a completion
+ */
+void uring_seen(struct uring *r);
+
+#endif /* _UTHREAD_URING_H */
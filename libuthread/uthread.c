@@ -1,183 +1,1674 @@
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "deque.h"
 #include "private.h"
+#include "uring.h"
 #include "uthread.h"
-#include "queue.h"
+#include "wheel.h"
 
-queue_t rq; // Queue for ready threads
-queue_t zq; // Queue for terminated threads
-struct uthread_tcb *ct; // Pointer to the currently executing thread
-struct uthread_tcb *it; // Pointer to the idle thread
+// What the next thread to run has to do with the thread switched out
+enum switch_action {
+	SWITCH_NONE, // Nothing (thread blocked, or idle thread)
+	SWITCH_READY, // Enqueue it to the ready queue, as it yielded
+	SWITCH_EXIT, // Deallocate it, as it terminated
+	SWITCH_SLEEP, // Add it to the timer wheel, as it sleeps
+};
+
+/*
+ * Scheduler of a worker
+ *
+ * Each worker is a kernel thread whose original execution context is its "idle"
+ * thread: it picks the threads to run from the ready queue, and gets switched
+ * back to when there are none left. The ready queue has one FIFO per priority
+ * level (see uthread_set_mlfq()). With a single worker, they are plain lists.
+ * With several of them, they are work-stealing deques, from which the other
+ * workers take threads when they have none of the same priority.
+ *
+ * A thread being switched out can't be resumed by another worker until its
+ * context is fully saved. Hence enqueueing it to the ready queue, deallocating
+ * it, or releasing the lock of the waiting list it blocks on is left to the
+ * thread switched to (see thread_switch()).
+ */
+struct sched {
+	struct uthread_tcb *ct; // Currently executing thread
+	struct uthread_tcb idle; // Idle thread
+	struct list_head free_tcbs; // Deallocated TCBs, to be reused first
+	unsigned int nfree; // Number of TCBs in free_tcbs
+	struct tcb_slab *slabs; // TCBs allocated by this worker
+	struct list_head rq[UTHREAD_PRIO_LEVELS]; // Queues for ready threads (single worker)
+	unsigned int rq_mask; // Levels whose queue in rq isn't empty
+	int nready; // Number of threads in rq
+	struct deque dq[UTHREAD_PRIO_LEVELS]; // Queues for ready threads (several workers)
+	unsigned int boost_ticks; // Time slices since the last priority boost
+	struct uthread_tcb *prev; // Thread switched out
+	enum switch_action action; // What to do with prev
+	spinlock_t *unlock; // Lock to release for prev
+	int epfd; // Epoll instance for the threads waiting for I/O
+	int evfd; // Event in epfd, to wake up the worker when parked
+	unsigned int nio; // Number of threads waiting for I/O in epfd
+	struct uring *ring; // Ring for asynchronous I/O, if enabled
+	unsigned int nring; // Number of threads waiting for completions in ring
+	struct wheel timers; // Timers of the sleeping threads
+	spinlock_t timers_lock; // Protects timers, as others cancel timeouts
+	unsigned int switches; // Number of yields, to poll epfd periodically
+	void *shared_stack; // Stack of the threads with a shared stack, if any
+	void *copy_stack; // Stack to copy shared_stack from, see stack_switch()
+	struct uthread_tcb *stack_owner; // Thread whose frames are on shared_stack
+	uthread_stats_t exited; // Statistics of the threads terminated here
+	atomic_bool parked; // Worker waiting in epfd for something to do
+	unsigned int id; // Index in scheds[]
+	pthread_t pthread; // Kernel thread of the worker
+} __attribute__((aligned(64))); // Keep workers on separate cache lines
+
+// Poll for I/O every so many yields, if threads wait for some
+#define IO_POLL_SWITCHES 64
+
+// Maximum number of I/O events handled per poll
+#define IO_POLL_EVENTS 64
+
+// Number of submission entries of the rings
+#define IO_RING_ENTRIES 256
+
+// Number of TCBs allocated at once, and moved at once between workers
+#define TCB_SLAB 64
+
+// Block of TCBs allocated at once
+struct tcb_slab {
+	struct tcb_slab *next; // Next slab of the same worker
+	struct uthread_tcb tcbs[TCB_SLAB];
+};
+
+// Duration of a tick of the timer wheels, 2^TIMER_SHIFT ns (about 16us)
+#define TIMER_SHIFT 14
+
+// Operation submitted to a ring by a thread, see uthread_io_submit()
+struct io_req {
+	struct uthread_tcb *uthread; // Thread waiting for the completion
+	int res; // Result of the operation
+};
+
+static unsigned int nworkers = 1; // Number of workers, see uthread_set_workers()
+static struct sched *scheds; // Schedulers of the workers, while running
+static unsigned int nscheds; // Number of entries in scheds
+static unsigned int nstarted; // Number of workers actually running
+static atomic_int nlive; // Number of threads created and not terminated yet
+bool uthread_parallel;
+
+// Multi-level feedback queue configuration, see uthread_set_mlfq()
+static unsigned int nlevels = 1; // Number of priority levels
+static unsigned int quanta[UTHREAD_PRIO_LEVELS] = { 1 }; // Time slices per level
+static unsigned int boost_period; // Time slices between boosts, 0 for none
+
+// Execution statistics, see uthread_set_stats()
+static bool stats_enabled; // Time accounting configured
+static bool stats_on; // Time accounting of the current run
+static uthread_sched_stats_t run_stats; // Statistics of the last run
+static bool run_stats_valid; // run_stats is set
+
+static __thread struct sched *sched_tls; // Scheduler of the calling worker
+
+// Queue for terminated threads, until joined or detached
+static struct list_head zq = LIST_HEAD_INIT(zq);
+static spinlock_t zq_lock = SPINLOCK_INIT;
 
-// Enum representing thread states
-typedef enum state
+/*
+ * Free TCBs in excess on a worker, for the others to take. Without it, when
+ * threads are created on one worker and terminate on another, the former would
+ * keep allocating TCBs while the latter accumulates them.
+ */
+static struct list_head free_tcbs = LIST_HEAD_INIT(free_tcbs);
+static spinlock_t free_tcbs_lock = SPINLOCK_INIT;
+
+/*
+ * Idle workers park in their epoll instance until new threads become ready,
+ * either because of I/O or because another worker woke them up. Once all of
+ * them are parked with no thread waiting for I/O, no thread can ever become
+ * ready again and the scheduling is over.
+ */
+static pthread_mutex_t park_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_uint nparked; // Number of parked workers
+static atomic_uint nio_total; // Number of threads waiting for I/O or timers
+static atomic_bool sched_done; // All workers must return
+
+/*
+ * Function to get the scheduler of the worker running the current thread
+ *
+ * A thread may be resumed by another worker than the one it was switched out
+ * from, but the compiler assumes the address of thread-local variables doesn't
+ * change within a function. Calling this function again after any switch makes
+ * sure to get the right one.
+ */
+static __attribute__((noinline)) struct sched *sched_self(void)
 {
-	running, // Thread is currently running
-	ready, // Thread is ready to run
-	blocked, // Thread is blocked
-	zombie // Thread has terminated
-} state_t;
+	return sched_tls;
+}
 
-struct uthread_tcb
+// Function to dequeue the oldest thread from a thread queue
+static struct uthread_tcb *thread_dequeue(struct list_head *q)
 {
-	state_t state; // State of the thread
-	void *stk; // Pointer to the thread's stack
-	uthread_ctx_t *ctx; // Pointer to the thread's context
-};
+	struct list_head *node = list_pop(q);
+
+	if (node == NULL)
+		return NULL;
+	return list_entry(node, struct uthread_tcb, node);
+}
+
+static void ready_enqueue(struct sched *s, struct uthread_tcb *uthread);
+
+// Function to interrupt a worker waiting in its epoll instance
+static void sched_wake(struct sched *s)
+{
+	uint64_t one = 1;
+
+	if (write(s->evfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		perror("write");
+}
+
+// Function to stop all the workers
+static void sched_stop(void)
+{
+	atomic_store(&sched_done, true);
+	for (unsigned int i = 0; i < nstarted; i++)
+		sched_wake(&scheds[i]);
+}
+
+// Function to wake up a parked worker, if any, after making a thread ready
+static void sched_notify(void)
+{
+	// Pairs with sched_park(): either the worker parking sees the new
+	// thread, or it is seen parked here
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&nparked, memory_order_relaxed) == 0)
+		return;
+
+	for (unsigned int i = 0; i < nstarted; i++) {
+		bool parked = true;
+
+		if (atomic_compare_exchange_strong(&scheds[i].parked, &parked,
+						   false)) {
+			sched_wake(&scheds[i]);
+			return;
+		}
+	}
+}
+
+// Function to make the threads whose operations completed runnable again
+static void io_ring_reap(struct sched *s)
+{
+	struct io_uring_cqe *cqe;
+
+	while ((cqe = uring_peek(s->ring)) != NULL) {
+		struct io_req *req = (struct io_req *)(uintptr_t)cqe->user_data;
+
+		req->res = cqe->res;
+		uring_seen(s->ring);
+		s->nring--;
+		atomic_fetch_sub(&nio_total, 1);
+		ready_enqueue(s, req->uthread);
+	}
+}
+
+// Function to submit the queued operations, and collect the completed ones
+static void io_ring_flush(struct sched *s, bool wait)
+{
+	// Interruptions and transient failures are retried at the next pass
+	if ((wait || uring_pending(s->ring)) &&
+	    uring_submit(s->ring, wait, preempt_idle_mask()) &&
+	    errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		perror("io_uring_enter");
+	io_ring_reap(s);
+}
+
+// Function to get the current time, in nanoseconds
+static uint64_t clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Function to make the sleeping threads whose deadline passed runnable again,
+ * along with the waiting ones whose timeout wasn't canceled in the meantime
+ */
+static void timers_expire(struct sched *s)
+{
+	struct list_head expired = LIST_HEAD_INIT(expired);
+	struct list_head woken = LIST_HEAD_INIT(woken);
+	struct list_head *node;
+
+	spin_lock(&s->timers_lock);
+	wheel_advance(&s->timers, clock_ns() >> TIMER_SHIFT, &expired);
+	while ((node = list_pop(&expired)) != NULL) {
+		struct uthread_tcb *uthread =
+			list_entry(node, struct uthread_tcb, timer.node);
+		int pending = TIMEOUT_PENDING;
+
+		// Lost to uthread_cancel_timeout(), which makes it ready, once
+		// it gets our lock to see that the timer is gone
+		if (atomic_load_explicit(&uthread->timeout, memory_order_relaxed) !=
+		    TIMEOUT_NONE &&
+		    !atomic_compare_exchange_strong(&uthread->timeout, &pending,
+						    TIMEOUT_EXPIRED))
+			continue;
+		list_add_tail(node, &woken);
+	}
+	spin_unlock(&s->timers_lock);
+
+	while ((node = list_pop(&woken)) != NULL) {
+		struct uthread_tcb *uthread =
+			list_entry(node, struct uthread_tcb, timer.node);
+
+		// The waiting list can't be locked here, as the current thread
+		// may be blocking on it. With a single worker, nothing else
+		// uses it meanwhile, and the ready queue needs the link. With
+		// several, the thread leaves it by itself once it runs
+		if (uthread->timeout == TIMEOUT_EXPIRED && !uthread_parallel)
+			list_del(&uthread->node);
+		atomic_fetch_sub(&nio_total, 1);
+		ready_enqueue(s, uthread);
+	}
+}
+
+// Function to get the time until the next timer of a worker, -1 if none
+static int64_t timers_timeout(struct sched *s)
+{
+	uint64_t next;
+	uint64_t now;
+
+	spin_lock(&s->timers_lock);
+	next = wheel_next(&s->timers);
+	spin_unlock(&s->timers_lock);
+	if (next == UINT64_MAX)
+		return -1;
+	now = clock_ns();
+	next <<= TIMER_SHIFT;
+	return next > now ? (int64_t)(next - now) : 0;
+}
+
+// Function to make the threads whose I/O is ready runnable again, waiting up
+// to @timeout ns for some (forever if negative)
+static void io_poll(struct sched *s, int64_t timeout)
+{
+	struct epoll_event events[IO_POLL_EVENTS];
+	struct timespec ts = {
+		.tv_sec = timeout / 1000000000,
+		.tv_nsec = timeout % 1000000000,
+	};
+	int n;
+
+	// Waiting is only done by idle workers, which ticks must not wake up
+	n = epoll_pwait2(s->epfd, events, IO_POLL_EVENTS,
+			 timeout < 0 ? NULL : &ts,
+			 timeout ? preempt_idle_mask() : NULL);
+	for (int i = 0; i < n; i++) {
+		struct uthread_tcb *uthread = events[i].data.ptr;
+
+		if (uthread == NULL) {
+			// Woken up by another worker
+			uint64_t count;
+
+			if (read(s->evfd, &count, sizeof(count)) < 0 &&
+			    errno != EAGAIN)
+				perror("read");
+			continue;
+		}
+
+		s->nio--;
+		atomic_fetch_sub(&nio_total, 1);
+		ready_enqueue(s, uthread);
+	}
+
+	// Completions signal the eventfd too
+	if (s->ring != NULL)
+		io_ring_reap(s);
+}
+
+// Function to wait, as the idle thread of the only worker, for some I/O or
+// for the next timer
+static void io_wait(struct sched *s)
+{
+	int64_t timeout = timers_timeout(s);
+
+	if (s->nio == 0 && timeout < 0) {
+		// Only the ring to wait for, within the submission system call
+		io_ring_flush(s, true);
+		return;
+	}
+
+	if (s->ring != NULL)
+		io_ring_flush(s, false);
+	io_poll(s, timeout);
+}
+
+// Function to check whether a worker has ready threads above level @level
+static bool sched_has_ready(struct sched *s, unsigned int level)
+{
+	if (!uthread_parallel)
+		return s->rq_mask & ((1u << level) - 1);
+
+	for (unsigned int l = 0; l < level; l++)
+		if (deque_size(&s->dq[l]))
+			return true;
+	return false;
+}
+
+// Function to check whether any worker has ready threads
+static bool sched_has_work(void)
+{
+	for (unsigned int i = 0; i < nscheds; i++)
+		if (sched_has_ready(&scheds[i], nlevels))
+			return true;
+	return false;
+}
+
+// Function to wait, as an idle worker, for threads to become ready
+static void sched_park(struct sched *s)
+{
+	bool idle;
+
+	// Submit the operations of the threads that just blocked before sleeping
+	if (s->ring != NULL)
+		io_ring_flush(s, false);
+
+	pthread_mutex_lock(&park_lock);
+	atomic_store(&s->parked, true);
+	atomic_fetch_add(&nparked, 1);
+	idle = !sched_has_work() && !atomic_load(&sched_done);
+	if (idle && atomic_load(&nparked) == nstarted &&
+	    atomic_load(&nio_total) == 0) {
+		// Nobody left to make any thread ready
+		sched_stop();
+		idle = false;
+	}
+	pthread_mutex_unlock(&park_lock);
+
+	if (idle)
+		io_poll(s, timers_timeout(s));
+	atomic_store(&s->parked, false);
+	atomic_fetch_sub(&nparked, 1);
+}
+
+// Function to mark a thread ready, accounting for the time it was blocked
+static void thread_ready(struct uthread_tcb *uthread)
+{
+	if (uthread->state == blocked) {
+		trace_uthread(TRACE_UNBLOCK, uthread, 0);
+		if (stats_on) {
+			uint64_t now = clock_ns();
+
+			uthread->stats.blocked_ns += now - uthread->since;
+			uthread->since = now;
+		}
+	}
+	uthread->state = ready;
+}
+
+// Function to enqueue a thread to the ready queue of a worker
+static void ready_enqueue(struct sched *s, struct uthread_tcb *uthread)
+{
+	thread_ready(uthread);
+
+	if (!uthread_parallel) {
+		list_add_tail(&uthread->node, &s->rq[uthread->level]);
+		s->rq_mask |= 1u << uthread->level;
+		if (s->nready++ == 0)
+			preempt_contention(true);
+		return;
+	}
+
+	if (deque_push(&s->dq[uthread->level], uthread)) {
+		// The thread can't be dropped, and there is no caller to report to
+		perror("deque_push");
+		exit(1);
+	}
+	preempt_contention(true);
+	sched_notify();
+}
+
+// Function to take the oldest thread of level @level, from any worker
+static struct uthread_tcb *ready_steal(struct sched *s, unsigned int level)
+{
+	struct uthread_tcb *uthread = NULL;
+
+	// Our own threads first
+	while (uthread == NULL && deque_size(&s->dq[level]))
+		uthread = deque_steal(&s->dq[level]);
+
+	// Otherwise, steal from the other workers
+	for (unsigned int i = 1; uthread == NULL && i < nscheds; i++)
+		uthread = deque_steal(&scheds[(s->id + i) % nscheds].dq[level]);
+
+	return uthread;
+}
+
+// Function to dequeue the next thread to run above level @max, NULL if none
+static struct uthread_tcb *ready_dequeue(struct sched *s, unsigned int max)
+{
+	struct uthread_tcb *uthread = NULL;
+
+	// Every scheduling pass expires the timers due
+	if (s->timers.count)
+		timers_expire(s);
+
+	if (!uthread_parallel) {
+		unsigned int level;
+
+		if ((s->rq_mask & ((1u << max) - 1)) == 0)
+			return NULL;
+
+		// Oldest thread of the highest priority
+		level = __builtin_ctz(s->rq_mask);
+		uthread = thread_dequeue(&s->rq[level]);
+		if (list_empty(&s->rq[level]))
+			s->rq_mask &= ~(1u << level);
+		if (--s->nready == 0)
+			preempt_contention(false);
+		return uthread;
+	}
+
+	for (unsigned int level = 0; uthread == NULL && level < max; level++)
+		uthread = ready_steal(s, level);
+
+	preempt_contention(sched_has_ready(s, nlevels));
+	return uthread;
+}
+
+// Function to bring the ready threads of a worker back to the highest level
+static void sched_boost(struct sched *s)
+{
+	struct uthread_tcb *uthread;
+
+	for (unsigned int level = 1; level < nlevels; level++) {
+		if (!uthread_parallel) {
+			// Keep the order of the threads within the new level
+			while ((uthread = thread_dequeue(&s->rq[level])) != NULL) {
+				uthread->level = 0;
+				uthread->ticks = 0;
+				list_add_tail(&uthread->node, &s->rq[0]);
+				s->rq_mask |= 1u;
+			}
+			s->rq_mask &= ~(1u << level);
+			continue;
+		}
+
+		// Only the threads found in our deque now, others may steal them
+		for (long n = deque_size(&s->dq[level]); n > 0; n--) {
+			uthread = deque_steal(&s->dq[level]);
+			if (uthread == NULL)
+				break;
+			uthread->level = 0;
+			uthread->ticks = 0;
+			ready_enqueue(s, uthread);
+		}
+	}
+}
+
+bool uthread_tick(void)
+{
+	struct sched *s = sched_self();
+	struct uthread_tcb *uthread = s->ct;
+
+	if (uthread == &s->idle)
+		return false;
+
+	// Periodically give starving threads another chance
+	if (boost_period && ++s->boost_ticks >= boost_period) {
+		s->boost_ticks = 0;
+		uthread->level = 0;
+		uthread->ticks = 0;
+		sched_boost(s);
+	}
+
+	// Demote the thread once it used up the quantum of its level
+	if (++uthread->ticks >= quanta[uthread->level]) {
+		uthread->ticks = 0;
+		if (uthread->level + 1 < nlevels)
+			uthread->level++;
+		return true;
+	}
+
+	return sched_has_ready(s, uthread->level);
+}
+
+// Function to get the next thread to run, the idle thread if there is none
+static struct uthread_tcb *next_thread(struct sched *s)
+{
+	struct uthread_tcb *uthread = ready_dequeue(s, nlevels);
+
+	return uthread != NULL ? uthread : &s->idle;
+}
+
+// Function to add the statistics of a thread to a sum
+static void stats_add(uthread_stats_t *sum, const uthread_stats_t *stats)
+{
+	sum->run_ns += stats->run_ns;
+	sum->ready_ns += stats->ready_ns;
+	sum->blocked_ns += stats->blocked_ns;
+	sum->voluntary += stats->voluntary;
+	sum->preempted += stats->preempted;
+	sum->sem_waits += stats->sem_waits;
+}
+
+// Function to get the statistics of a thread, up to @now in its current state
+static void thread_stats(const struct uthread_tcb *uthread, uint64_t now,
+			 uthread_stats_t *stats)
+{
+	// Another worker may have changed state since @now was read
+	uint64_t elapsed = stats_on && now > uthread->since ?
+		now - uthread->since : 0;
+
+	*stats = uthread->stats;
+	switch (uthread->state) {
+	case running:
+		stats->run_ns += elapsed;
+		break;
+	case ready:
+		stats->ready_ns += elapsed;
+		break;
+	case blocked:
+		stats->blocked_ns += elapsed;
+		break;
+	default:
+		break;
+	}
+}
+
+// Function to deallocate a terminated thread
+static void thread_free(struct sched *s, struct uthread_tcb *uthread)
+{
+	uthread->state = unused;
+	list_add(&uthread->node, &s->free_tcbs);
+	if (++s->nfree < 2 * TCB_SLAB)
+		return;
+
+	// Share the excess with the other workers
+	spin_lock(&free_tcbs_lock);
+	for (; s->nfree > TCB_SLAB; s->nfree--)
+		list_add(list_pop(&s->free_tcbs), &free_tcbs);
+	spin_unlock(&free_tcbs_lock);
+}
+
+// Function to allocate a TCB, reusing a deallocated one if possible
+static struct uthread_tcb *thread_alloc(struct sched *s)
+{
+	struct list_head *node;
+	struct tcb_slab *slab;
+
+	if (s->nfree == 0 && !list_empty(&free_tcbs)) {
+		// Take the excess of other workers
+		spin_lock(&free_tcbs_lock);
+		for (; s->nfree < TCB_SLAB; s->nfree++) {
+			node = list_pop(&free_tcbs);
+			if (node == NULL)
+				break;
+			list_add(node, &s->free_tcbs);
+		}
+		spin_unlock(&free_tcbs_lock);
+	}
+
+	node = list_pop(&s->free_tcbs);
+	if (node != NULL) {
+		s->nfree--;
+		return list_entry(node, struct uthread_tcb, node);
+	}
+
+	slab = malloc(sizeof(*slab));
+	if (slab == NULL)
+		return NULL;
+	slab->next = s->slabs;
+	s->slabs = slab;
+	for (unsigned int i = 1; i < TCB_SLAB; i++) {
+		slab->tcbs[i].state = unused;
+		list_add_tail(&slab->tcbs[i].node, &s->free_tcbs);
+	}
+	s->nfree = TCB_SLAB - 1;
+	return &slab->tcbs[0];
+}
+
+// Function to remove a terminated thread from the zombie queue
+static void zombie_remove(struct uthread_tcb *uthread)
+{
+	spin_lock(&zq_lock);
+	list_del(&uthread->node);
+	spin_unlock(&zq_lock);
+}
+
+// Function to finish terminating a thread, once switched out of it
+static void thread_exited(struct sched *s, struct uthread_tcb *uthread)
+{
+	struct uthread_tcb *joiner = NULL;
+	bool detached;
+
+	// Its stack can only be released now that it no longer runs on it
+	if (uthread->stk_shared) {
+		if (s->stack_owner == uthread)
+			s->stack_owner = NULL;
+		free(uthread->saved);
+		uthread->saved = NULL;
+	} else if (!uthread->stk_user) {
+		uthread_ctx_destroy_stack(uthread->stk, uthread->stk_size);
+	}
+	uthread->stk = NULL;
+
+	stats_add(&s->exited, &uthread->stats);
+
+	spin_lock(&uthread->lock);
+	uthread->state = zombie;
+	detached = uthread->detached;
+	if (!detached) {
+		// Keep the TCB, and its exit value, until joined or detached
+		spin_lock(&zq_lock);
+		list_add_tail(&uthread->node, &zq);
+		spin_unlock(&zq_lock);
+		joiner = uthread->joiner;
+	}
+	spin_unlock(&uthread->lock);
+
+	if (detached)
+		thread_free(s, uthread);
+	else if (joiner != NULL)
+		ready_enqueue(s, joiner);
+
+	if (atomic_fetch_sub(&nlive, 1) == 1 && uthread_parallel)
+		sched_stop();
+}
+
+// Function to complete a switch, on the thread switched to
+static void switch_finish(struct sched *s)
+{
+	switch (s->action) {
+	case SWITCH_READY:
+		ready_enqueue(s, s->prev);
+		break;
+	case SWITCH_EXIT:
+		thread_exited(s, s->prev);
+		break;
+	case SWITCH_SLEEP:
+		spin_lock(&s->timers_lock);
+		s->prev->timer_sched = s;
+		wheel_add(&s->timers, &s->prev->timer);
+		spin_unlock(&s->timers_lock);
+		break;
+	case SWITCH_NONE:
+		break;
+	}
+	if (s->unlock != NULL)
+		spin_unlock(s->unlock);
+
+	s->prev = NULL;
+	s->action = SWITCH_NONE;
+	s->unlock = NULL;
+}
+
+void uthread_switch_finish(void)
+{
+	switch_finish(sched_self());
+}
+
+#ifdef UTHREAD_CTX_SWITCH_VIA
+/*
+ * Function to hand the shared stack of a worker over to its current thread
+ *
+ * Called on copy_stack, in between switching out of the previous thread and
+ * switching to the current one. The frames of the thread on the shared stack
+ * are only saved now that another one needs it, so that switches to threads
+ * with stacks of their own, and back, don't copy anything.
+ */
+static void stack_switch(void *arg)
+{
+	struct sched *s = arg;
+	struct uthread_tcb *owner = s->stack_owner;
+	struct uthread_tcb *next = s->ct;
+	char *top = (char *)s->shared_stack + UTHREAD_SHARED_STACK_SIZE;
+
+	// The frames of a terminated thread are just dropped
+	if (owner != NULL && (owner != s->prev || s->action != SWITCH_EXIT)) {
+		size_t used = top - (char *)owner->context.sp;
+
+		// Keep the copy about the size of what it holds
+		if (used > owner->saved_cap || used < owner->saved_cap / 4) {
+			size_t cap = (used + 255) & ~(size_t)255;
+			void *saved = realloc(owner->saved, cap);
+
+			if (saved == NULL) {
+				perror("realloc");
+				exit(1);
+			}
+			owner->saved = saved;
+			owner->saved_cap = cap;
+		}
+		memcpy(owner->saved, owner->context.sp, used);
+		owner->saved_size = used;
+	}
+
+	if (next->func != NULL) {
+		// First run: the thread starts from the top of the stack
+		uthread_ctx_init(next->ctx, s->shared_stack,
+				 UTHREAD_SHARED_STACK_SIZE, next->func, next->arg);
+		next->func = NULL;
+	} else {
+		memcpy(top - next->saved_size, next->saved, next->saved_size);
+	}
+	s->stack_owner = next;
+}
+#endif
+
+// Function to allocate the shared stack of the calling worker, if not yet
+static int shared_stack_alloc(void)
+{
+#ifdef UTHREAD_CTX_SWITCH_VIA
+	struct sched *s;
+	int ret = 0;
+
+	// The frames of the threads hold addresses within the shared stack,
+	// so they can't move to the one of another worker
+	if (uthread_parallel)
+		return -1;
+
+	preempt_disable();
+	s = sched_self();
+	if (s->shared_stack == NULL) {
+		s->shared_stack = uthread_ctx_alloc_stack(UTHREAD_SHARED_STACK_SIZE);
+		s->copy_stack = uthread_ctx_alloc_stack(UTHREAD_STACK_SIZE);
+		if (s->shared_stack == NULL || s->copy_stack == NULL) {
+			if (s->shared_stack != NULL)
+				uthread_ctx_destroy_stack(s->shared_stack,
+							  UTHREAD_SHARED_STACK_SIZE);
+			if (s->copy_stack != NULL)
+				uthread_ctx_destroy_stack(s->copy_stack,
+							  UTHREAD_STACK_SIZE);
+			s->shared_stack = NULL;
+			s->copy_stack = NULL;
+			ret = -1;
+		}
+	}
+	preempt_enable();
+	return ret;
+#else
+	// Requires switching through another stack
+	return -1;
+#endif
+}
+
+// Function to switch from the current thread to @next, preemption disabled
+static void thread_switch(struct uthread_tcb *next, enum switch_action action,
+			  spinlock_t *unlock)
+{
+	struct sched *s = sched_self();
+	struct uthread_tcb *prev = s->ct;
+	int depth = preempt_save();
+
+	s->prev = prev;
+	s->action = action;
+	s->unlock = unlock;
+	trace_uthread(TRACE_SWITCH, next, prev->trace_id);
+	if (stats_on) {
+		// The idle thread runs while the worker is idle
+		uint64_t now = clock_ns();
+
+		prev->stats.run_ns += now - prev->since;
+		prev->since = now;
+		if (next->state == ready)
+			next->stats.ready_ns += now - next->since;
+		next->since = now;
+	}
+	next->state = running;
+	s->ct = next;
+#ifdef UTHREAD_CTX_SWITCH_VIA
+	if (next->stk_shared && s->stack_owner != next)
+		// The shared stack can't be swapped while running on it
+		uthread_ctx_switch_via(prev->ctx, next->ctx, s->copy_stack,
+				       UTHREAD_STACK_SIZE, stack_switch, s);
+	else
+#endif
+		uthread_ctx_switch(prev->ctx, next->ctx);
+
+	// Back in @prev, possibly on another worker
+	switch_finish(sched_self());
+	preempt_restore(depth);
+}
 
 // Function to get the currently executing thread
 struct uthread_tcb *uthread_current(void)
 {
-	return ct;
+	return sched_self()->ct;
 }
 
-// Function to yield the CPU to the next ready thread
-void uthread_yield(void)
+// Function to yield, because of a preemption if @preempted
+static void yield(bool preempted)
 {
+	struct sched *s;
+	struct uthread_tcb *next;
+
 	// Disable preemption
 	preempt_disable();
-	struct uthread_tcb *nt;
-	struct uthread_tcb *current = uthread_current();
-
-	// Enqueue the current thread to the ready queue
-	queue_enqueue(rq, ct);
-	// Dequeue the next thread from the ready queue
-	queue_dequeue(rq, (void **)&nt);
-
-	if (nt == NULL)
-		perror("queue_dequeue");
 
-	// Update states of current and next threads
-	ct->state = ready;
-	nt->state = running;
+	// Dequeue the next thread from the ready queue and switch to it, the
+	// current thread being enqueued once switched out. If there is none of
+	// the same priority or higher, keep running
+	s = sched_self();
+	// Every scheduling pass submits the operations queued since the last
+	// one, in a single system call, and collects those completed
+	if (s->nring)
+		io_ring_flush(s, false);
+	// Don't let threads waiting for I/O starve behind busy ones
+	if (s->nio && ++s->switches % IO_POLL_SWITCHES == 0)
+		io_poll(s, 0);
+	next = ready_dequeue(s, s->ct->level + 1);
+	if (next != NULL) {
+		if (preempted)
+			s->ct->stats.preempted++;
+		else
+			s->ct->stats.voluntary++;
+		thread_switch(next, SWITCH_READY, NULL);
+	}
 
-	ct = nt;
-	// Perform a context switch
-	uthread_ctx_switch(current->ctx, nt->ctx);
 	// Enable preemption
 	preempt_enable();
 }
 
+// Function to yield the CPU to the next ready thread
+void uthread_yield(void)
+{
+	yield(false);
+}
+
+void uthread_preempt(void)
+{
+	yield(true);
+}
+
 // Function to terminate the currently executing thread
-void uthread_exit(void)
+void uthread_exit(void *retval)
 {
-	ct->state = zombie;
-	// Destroy the stack of the terminated thread
-	uthread_ctx_destroy_stack(ct->stk);
-	// Enqueue the terminated thread to the zombie queue
-	queue_enqueue(zq, uthread_current());
-	struct uthread_tcb *nt;
-	queue_dequeue(rq, (void **)&nt);
+	struct sched *s;
+
+	// Never to be enabled again in this thread
+	preempt_disable();
 
-	struct uthread_tcb *curr = ct;
-	ct = nt;
-	ct->state = running;
-	uthread_ctx_switch(curr->ctx, nt->ctx);
+	s = sched_self();
+	trace_uthread(TRACE_EXIT, s->ct, (uintptr_t)retval);
+	s->ct->retval = retval;
+	// The thread switched to finishes terminating this one
+	thread_switch(next_thread(s), SWITCH_EXIT, NULL);
+}
+
+// Function to set thread creation attributes to their defaults
+void uthread_attr_init(uthread_attr_t *attr)
+{
+	attr->stack_size = UTHREAD_STACK_SIZE;
+	attr->stack = NULL;
+	attr->name = NULL;
+	attr->priority = 0;
+	attr->shared_stack = false;
+}
+
+uthread_t uthread_create(uthread_func_t func, void *arg)
+{
+	return uthread_create_attr(NULL, func, arg);
 }
 
 // Function to create a new thread
-int uthread_create(uthread_func_t func, void *arg)
+uthread_t uthread_create_attr(const uthread_attr_t *attr, uthread_func_t func,
+			      void *arg)
 {
-	struct uthread_tcb *nt = malloc(sizeof(struct uthread_tcb));
+	struct uthread_tcb *nt;
+	uthread_attr_t defaults;
+
+	if (attr == NULL) {
+		uthread_attr_init(&defaults);
+		attr = &defaults;
+	}
+	if (attr->stack_size && attr->stack_size < UTHREAD_STACK_MIN)
+		return NULL;
+	if (attr->stack != NULL && attr->stack_size == 0)
+		return NULL;
+	if (attr->shared_stack && shared_stack_alloc())
+		return NULL;
+
+	preempt_disable();
+	nt = thread_alloc(sched_self());
+	preempt_enable();
 	if (nt == NULL)
-		return -1;
+		return NULL;
 
 	// Initialize the new thread
 	nt->state = ready;
-	nt->stk = uthread_ctx_alloc_stack();
+	nt->level = attr->priority < nlevels ? attr->priority : nlevels - 1;
+	nt->ticks = 0;
+	spin_init(&nt->lock);
+	nt->joiner = NULL;
+	nt->retval = NULL;
+	nt->detached = false;
+	atomic_init(&nt->timeout, TIMEOUT_NONE);
+	memset(&nt->stats, 0, sizeof(nt->stats));
+	nt->since = stats_on ? clock_ns() : 0;
+	nt->name[0] = '\0';
+	if (attr->name != NULL)
+		strncat(nt->name, attr->name, UTHREAD_NAME_MAX - 1);
+	nt->ctx = &nt->context;
+	nt->stk_shared = attr->shared_stack;
+	nt->saved = NULL;
+	nt->saved_size = 0;
+	nt->saved_cap = 0;
+	nt->func = NULL;
+	nt->stk_user = attr->stack != NULL && !nt->stk_shared;
+	if (nt->stk_shared) {
+		// Its context is initialized on the shared stack when it first
+		// gets switched to (see stack_switch())
+		nt->stk = NULL;
+		nt->stk_size = 0;
+		nt->func = func;
+		nt->arg = arg;
+	} else {
+		if (nt->stk_user) {
+			nt->stk = attr->stack;
+			nt->stk_size = attr->stack_size;
+		} else {
+			nt->stk_size = uthread_ctx_stack_size(attr->stack_size ?
+							      attr->stack_size :
+							      UTHREAD_STACK_SIZE);
+			// A thread exiting meanwhile would put its stack back
+			// into the same cache
+			preempt_disable();
+			nt->stk = uthread_ctx_alloc_stack(nt->stk_size);
+			preempt_enable();
+		}
+		if (nt->stk == NULL ||
+		    uthread_ctx_init(nt->ctx, nt->stk, nt->stk_size, func,
+				     arg) == -1) {
+			preempt_disable();
+			if (nt->stk != NULL && !nt->stk_user)
+				uthread_ctx_destroy_stack(nt->stk, nt->stk_size);
+			thread_free(sched_self(), nt);
+			preempt_enable();
+			return NULL;
+		}
+	}
+
+	// Enqueue the new thread to the ready queue
+	atomic_fetch_add(&nlive, 1);
+	preempt_disable();
+	trace_create(nt);
+	ready_enqueue(sched_self(), nt);
+	preempt_enable();
+	return nt;
+}
+
+const char *uthread_get_name(uthread_t uthread)
+{
+	return uthread->name;
+}
+
+// Function to get the handle of the currently executing thread
+uthread_t uthread_self(void)
+{
+	struct sched *s;
+	uthread_t self = NULL;
 
-	if (nt->stk == NULL)
+	preempt_disable();
+	s = sched_self();
+	if (s != NULL && s->ct != &s->idle)
+		self = s->ct;
+	preempt_enable();
+	return self;
+}
+
+// Function to wait for a thread to terminate
+int uthread_join(uthread_t uthread, void **retval)
+{
+	struct sched *s;
+
+	if (uthread == NULL)
 		return -1;
 
-	nt->ctx = malloc(sizeof(uthread_ctx_t));
-	if (nt->ctx == NULL)
+	preempt_disable();
+	s = sched_self();
+	if (s == NULL || s->ct == &s->idle || s->ct == uthread) {
+		preempt_enable();
 		return -1;
+	}
 
-	int ret = uthread_ctx_init(nt->ctx, nt->stk, func, arg);
-	if (ret == -1)
+	spin_lock(&uthread->lock);
+	if (uthread->detached || uthread->joiner != NULL) {
+		spin_unlock(&uthread->lock);
+		preempt_enable();
 		return -1;
+	}
+	uthread->joiner = s->ct;
+	if (uthread->state != zombie)
+		// Woken up by thread_exited(), once @uthread is a zombie
+		uthread_block(&uthread->lock);
+	else
+		spin_unlock(&uthread->lock);
 
-	// Enqueue the new thread to the ready queue
-	queue_enqueue(rq, nt);
+	// Being its joiner, nobody else can access @uthread anymore
+	zombie_remove(uthread);
+	if (retval != NULL)
+		*retval = uthread->retval;
+	thread_free(sched_self(), uthread);
+	preempt_enable();
 	return 0;
 }
 
-// Function to run the threads
-int uthread_run(bool preempt, uthread_func_t func, void *arg)
+// Function to let a thread be deallocated as soon as it terminates
+int uthread_detach(uthread_t uthread)
 {
-	if (preempt)
-		preempt_start(preempt);
+	bool terminated;
 
-	// Create the ready and zombie queues
-	rq = queue_create();
-	zq = queue_create();
+	if (uthread == NULL)
+		return -1;
 
-	if (rq == NULL || zq == NULL)
+	preempt_disable();
+	spin_lock(&uthread->lock);
+	if (uthread->detached || uthread->joiner != NULL) {
+		spin_unlock(&uthread->lock);
+		preempt_enable();
 		return -1;
+	}
+	uthread->detached = true;
+	terminated = uthread->state == zombie;
+	spin_unlock(&uthread->lock);
+
+	if (terminated) {
+		zombie_remove(uthread);
+		thread_free(sched_self(), uthread);
+	}
+	preempt_enable();
+	return 0;
+}
+
+// Function to run the idle thread of a worker, until scheduling is over
+static void sched_loop(struct sched *s)
+{
+	struct uthread_tcb *next;
+
+	// The idle thread is never preempted
+	preempt_disable();
+
+	while (!atomic_load(&sched_done)) {
+		next = ready_dequeue(s, nlevels);
+		if (next != NULL) {
+			thread_switch(next, SWITCH_NONE, NULL);
+			continue;
+		}
+
+		// Check if all threads are completed, or blocked for good
+		if (!uthread_parallel) {
+			if (s->nio == 0 && s->nring == 0 &&
+			    s->timers.count == 0)
+				break;
+			io_wait(s);
+			continue;
+		}
+		sched_park(s);
+	}
+
+	preempt_enable();
+}
 
-	it = malloc(sizeof(struct uthread_tcb));
-	if (it == NULL)
+// Function run by the kernel threads of the additional workers
+static void *worker_main(void *arg)
+{
+	struct sched *s = arg;
+
+	sched_tls = s;
+	trace_start_worker(s->id);
+	preempt_start_worker();
+	sched_loop(s);
+	preempt_stop_worker();
+	trace_stop_worker();
+	uthread_ctx_flush_stacks();
+	return NULL;
+}
+
+int uthread_wait_fd(int fd, uint32_t events)
+{
+	struct epoll_event ev;
+	struct sched *s;
+
+	preempt_disable();
+	s = sched_self();
+	if (s == NULL || s->ct == &s->idle) {
+		preempt_enable();
+		errno = EINVAL;
 		return -1;
-	it->state = running;
-	it->ctx = malloc(sizeof(uthread_ctx_t));
-	if (it->state != running || it->ctx == NULL)
+	}
+
+	// One-shot, so that the descriptor is ignored again once ready, without
+	// having to remove it
+	ev.events = events | EPOLLONESHOT;
+	ev.data.ptr = s->ct;
+	if (epoll_ctl(s->epfd, EPOLL_CTL_MOD, fd, &ev) &&
+	    (errno != ENOENT || epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &ev))) {
+		preempt_enable();
 		return -1;
+	}
 
-	ct = it;
+	s->nio++;
+	atomic_fetch_add(&nio_total, 1);
+	// Only this worker polls its epoll instance, once switched out of us
+	uthread_block(NULL);
+	preempt_enable();
+	return 0;
+}
+
+int uthread_io_submit(const struct io_uring_sqe *sqe, int *res)
+{
+	struct io_uring_sqe *slot;
+	struct io_req req;
+	struct sched *s;
 
-	// Create the initial thread
-	if (uthread_create(func, arg))
+	preempt_disable();
+	s = sched_self();
+	// The kernel would write to the stack of a thread with a shared stack
+	// while it's switched out, if the buffers or req were on it
+	if (s == NULL || s->ring == NULL || s->ct == &s->idle ||
+	    s->ct->stk_shared || s->nring >= uring_capacity(s->ring)) {
+		preempt_enable();
+		errno = EAGAIN;
 		return -1;
+	}
 
-	while (1)
-	{
-		// Check for completed threads
-		while (queue_length(zq) > 0)
-		{
-			// Deallocate the terminated threads
-			struct uthread_tcb *et;
-			queue_dequeue(zq, (void **)&et);
-			free(et);
+	slot = uring_get_sqe(s->ring);
+	if (slot == NULL) {
+		// Make room by submitting what is queued already
+		io_ring_flush(s, false);
+		slot = uring_get_sqe(s->ring);
+		if (slot == NULL) {
+			preempt_enable();
+			errno = EAGAIN;
+			return -1;
 		}
+	}
+	*slot = *sqe;
+	slot->user_data = (uintptr_t)&req;
+	uring_queue(s->ring);
 
-		// Check if all threads are completed
-		if (queue_length(rq) <= 0)
-			break;
+	req.uthread = s->ct;
+	s->nring++;
+	atomic_fetch_add(&nio_total, 1);
+	// Submitted at the next scheduling pass, which only this worker does
+	uthread_block(NULL);
+	preempt_enable();
+
+	*res = req.res;
+	return 0;
+}
+
+int uthread_sleep_until(uint64_t deadline)
+{
+	struct sched *s;
+
+	preempt_disable();
+	s = sched_self();
+	if (s == NULL || s->ct == &s->idle) {
+		preempt_enable();
+		return -1;
+	}
+
+	if (deadline <= clock_ns()) {
+		preempt_enable();
+		uthread_yield();
+		return 0;
+	}
+
+	// Round up to the next tick, so as not to wake up early
+	s->ct->timer.expires = (deadline + (1 << TIMER_SHIFT) - 1) >> TIMER_SHIFT;
+	trace_uthread(TRACE_BLOCK, s->ct, 0);
+	s->ct->stats.voluntary++;
+	s->ct->state = blocked;
+	atomic_fetch_add(&nio_total, 1);
+	// The thread switched to adds us to the wheel, once we're switched out
+	thread_switch(next_thread(s), SWITCH_SLEEP, NULL);
+	preempt_enable();
+	return 0;
+}
+
+int uthread_sleep_ns(uint64_t ns)
+{
+	return uthread_sleep_until(clock_ns() + ns);
+}
+
+int uthread_set_mlfq(unsigned int levels, const unsigned int *level_quanta,
+		     unsigned int boost)
+{
+	if (levels == 0 || levels > UTHREAD_PRIO_LEVELS || scheds != NULL)
+		return -1;
+	for (unsigned int i = 0; level_quanta != NULL && i < levels; i++)
+		if (level_quanta[i] == 0)
+			return -1;
+
+	nlevels = levels;
+	for (unsigned int i = 0; i < levels; i++)
+		quanta[i] = level_quanta != NULL ? level_quanta[i] : 1u << i;
+	boost_period = boost;
+	return 0;
+}
 
+int uthread_set_priority(unsigned int level)
+{
+	struct sched *s;
+	bool preempted;
+
+	if (level >= nlevels)
+		return -1;
+
+	preempt_disable();
+	s = sched_self();
+	if (s == NULL || s->ct == &s->idle) {
+		preempt_enable();
+		return -1;
+	}
+
+	s->ct->level = level;
+	s->ct->ticks = 0;
+	preempted = sched_has_ready(s, level);
+	preempt_enable();
+
+	if (preempted)
 		uthread_yield();
+	return 0;
+}
+
+int uthread_set_workers(unsigned int workers)
+{
+	if (workers == 0 || scheds != NULL)
+		return -1;
+
+	nworkers = workers;
+	return 0;
+}
+
+int uthread_set_stats(bool enable)
+{
+	if (scheds != NULL)
+		return -1;
+
+	stats_enabled = enable;
+	return 0;
+}
+
+int uthread_stats_get(uthread_t uthread, uthread_stats_t *stats)
+{
+	if (uthread == NULL || stats == NULL)
+		return -1;
+
+	preempt_disable();
+	thread_stats(uthread, stats_on ? clock_ns() : 0, stats);
+	preempt_enable();
+	return 0;
+}
+
+int uthread_stats_foreach(uthread_stats_func_t func, void *arg)
+{
+	if (uthread_self() == NULL)
+		return -1;
+
+	// Slabs are only ever added at the head of the lists, so they can be
+	// walked while threads get created
+	for (unsigned int i = 0; i < nscheds; i++) {
+		for (struct tcb_slab *slab = scheds[i].slabs; slab != NULL;
+		     slab = slab->next) {
+			for (unsigned int j = 0; j < TCB_SLAB; j++) {
+				struct uthread_tcb *uthread = &slab->tcbs[j];
+				uthread_stats_t stats;
+
+				preempt_disable();
+				if (uthread->state == unused) {
+					preempt_enable();
+					continue;
+				}
+				thread_stats(uthread, stats_on ? clock_ns() : 0,
+					     &stats);
+				preempt_enable();
+				func(uthread, &stats, arg);
+			}
+		}
+	}
+	return 0;
+}
+
+// Function to sum up the statistics of all the threads, while running
+static void sched_stats(uthread_sched_stats_t *stats)
+{
+	uint64_t now = stats_on ? clock_ns() : 0;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->threads = atomic_load(&nlive);
+	stats->workers = nscheds;
+
+	for (unsigned int i = 0; i < nscheds; i++) {
+		struct sched *s = &scheds[i];
+		uthread_stats_t idle;
+
+		// The idle thread is always "running", but only actually runs
+		// when it's the current thread of its worker
+		idle = s->idle.stats;
+		if (stats_on && s->ct == &s->idle && now > s->idle.since)
+			idle.run_ns += now - s->idle.since;
+		stats->idle_ns += idle.run_ns;
+
+		// Terminated threads were added up when terminating
+		stats_add(&stats->total, &s->exited);
+		for (struct tcb_slab *slab = s->slabs; slab != NULL;
+		     slab = slab->next) {
+			for (unsigned int j = 0; j < TCB_SLAB; j++) {
+				struct uthread_tcb *uthread = &slab->tcbs[j];
+				uthread_stats_t thread;
+
+				if (uthread->state == unused ||
+				    uthread->state == zombie)
+					continue;
+				thread_stats(uthread, now, &thread);
+				stats_add(&stats->total, &thread);
+			}
+		}
+	}
+}
+
+int uthread_sched_stats_get(uthread_sched_stats_t *stats)
+{
+	if (stats == NULL)
+		return -1;
+
+	preempt_disable();
+	if (scheds != NULL)
+		sched_stats(stats);
+	else if (run_stats_valid)
+		*stats = run_stats;
+	preempt_enable();
+	return scheds != NULL || run_stats_valid ? 0 : -1;
+}
+
+// Function to release the stack of a thread left blocked forever, if any
+static void thread_release(struct uthread_tcb *uthread)
+{
+	if (uthread->state == unused || uthread->state == zombie)
+		return;
+
+	if (uthread->stk_shared)
+		free(uthread->saved);
+	else if (!uthread->stk_user)
+		uthread_ctx_destroy_stack(uthread->stk, uthread->stk_size);
+}
+
+// Function to free the schedulers of the workers
+static void sched_free(void)
+{
+	for (unsigned int i = 0; i < nscheds; i++) {
+		for (unsigned int level = 0; level < nlevels; level++)
+			deque_destroy(&scheds[i].dq[level]);
+		if (scheds[i].ring != NULL)
+			uring_close(scheds[i].ring);
+		if (scheds[i].shared_stack != NULL) {
+			uthread_ctx_destroy_stack(scheds[i].shared_stack,
+						  UTHREAD_SHARED_STACK_SIZE);
+			uthread_ctx_destroy_stack(scheds[i].copy_stack,
+						  UTHREAD_STACK_SIZE);
+		}
+		close(scheds[i].epfd);
+		close(scheds[i].evfd);
+		while (scheds[i].slabs != NULL) {
+			struct tcb_slab *slab = scheds[i].slabs;
+
+			scheds[i].slabs = slab->next;
+			for (unsigned int j = 0; j < TCB_SLAB; j++)
+				thread_release(&slab->tcbs[j]);
+			free(slab);
+		}
+	}
+	list_init(&free_tcbs);
+	free(scheds);
+	scheds = NULL;
+	nscheds = 0;
+	uthread_parallel = false;
+}
+
+// Function to create the epoll instance of a worker
+static int sched_init_io(struct sched *s)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+
+	s->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (s->epfd < 0)
+		return -1;
+	s->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (s->evfd < 0 || epoll_ctl(s->epfd, EPOLL_CTL_ADD, s->evfd, &ev))
+		goto fail;
+
+	// Completions signal the eventfd, so that parked workers wake up
+	if (uthread_io_uring) {
+		s->ring = uring_open(IO_RING_ENTRIES, s->evfd);
+		if (s->ring == NULL)
+			goto fail;
+	}
+	return 0;
+
+fail:
+	if (s->evfd >= 0)
+		close(s->evfd);
+	close(s->epfd);
+	return -1;
+}
+
+// Function to allocate the schedulers of the workers
+static int sched_alloc(void)
+{
+	scheds = aligned_alloc(__alignof__(struct sched),
+			       nworkers * sizeof(struct sched));
+	if (scheds == NULL)
+		return -1;
+	memset(scheds, 0, nworkers * sizeof(struct sched));
+
+	for (nscheds = 0; nscheds < nworkers; nscheds++) {
+		struct sched *s = &scheds[nscheds];
+
+		if (sched_init_io(s)) {
+			sched_free();
+			return -1;
+		}
+		for (unsigned int level = 0; level < nlevels; level++) {
+			if (deque_init(&s->dq[level])) {
+				// Only free the deques of the previous workers
+				while (level--)
+					deque_destroy(&s->dq[level]);
+				if (s->ring != NULL)
+					uring_close(s->ring);
+				close(s->epfd);
+				close(s->evfd);
+				sched_free();
+				return -1;
+			}
+			list_init(&s->rq[level]);
+		}
+		wheel_init(&s->timers, clock_ns() >> TIMER_SHIFT);
+		spin_init(&s->timers_lock);
+		s->id = nscheds;
+		s->idle.state = running;
+		s->idle.ctx = &s->idle.context;
+		s->idle.since = stats_on ? clock_ns() : 0;
+		list_init(&s->free_tcbs);
+		s->ct = &s->idle;
+	}
+	return 0;
+}
+
+// Function to run the threads
+int uthread_run(bool preempt, uthread_func_t func, void *arg)
+{
+	struct uthread_tcb *first;
+	int blocked;
+
+	stats_on = stats_enabled;
+	if (sched_alloc())
+		return -1;
+
+	uthread_parallel = nscheds > 1;
+	atomic_store(&sched_done, false);
+	atomic_store(&nio_total, 0);
+	atomic_store(&nlive, 0);
+	sched_tls = &scheds[0];
+	trace_start(nscheds);
+	trace_start_worker(0);
+
+	// Create the initial thread, which nobody can join
+	first = uthread_create(func, arg);
+	if (first == NULL) {
+		trace_stop_worker();
+		sched_free();
+		return -1;
+	}
+	uthread_detach(first);
+
+	// Only start preemption once there is a thread to preempt
+	if (preempt)
+		preempt_start(preempt);
+
+	// Start the other workers; if some can't be, run with fewer of them
+	nstarted = 1;
+	for (unsigned int i = 1; i < nscheds; i++) {
+		int err;
+
+		pthread_mutex_lock(&park_lock);
+		err = pthread_create(&scheds[i].pthread, NULL, worker_main,
+				     &scheds[i]);
+		if (!err)
+			nstarted++;
+		pthread_mutex_unlock(&park_lock);
+		if (err)
+			break;
 	}
 
+	sched_loop(&scheds[0]);
+	trace_stop_worker();
+
+	for (unsigned int i = 1; i < nstarted; i++)
+		pthread_join(scheds[i].pthread, NULL);
+
 	if (preempt)
 		preempt_stop();
 
-	return 0;
+	// The scheduling only stops early once no thread is ready, and none
+	// waits for I/O or a timer: the threads left wait for each other
+	blocked = atomic_load(&nlive);
+	if (blocked > 0)
+		fprintf(stderr, "uthread: deadlock, %d thread%s blocked forever\n",
+			blocked, blocked > 1 ? "s" : "");
+
+	// Handles can't be joined past this point, and the TCBs of the zombies
+	// go away with the slabs
+	sched_stats(&run_stats);
+	run_stats_valid = true;
+	list_init(&zq);
+
+	sched_free();
+	sched_tls = NULL;
+	return blocked > 0 ? -1 : 0;
 }
 
 // Function to block the currently executing thread
-void uthread_block(void)
+void uthread_block(spinlock_t *lock)
 {
-	ct->state = blocked;
+	struct sched *s = sched_self();
 
-	// Get the next thread from the ready queue
-	struct uthread_tcb *nt;
-	queue_dequeue(rq, (void **)&nt);
+	trace_uthread(TRACE_BLOCK, s->ct, 0);
+	s->ct->stats.voluntary++;
+	s->ct->state = blocked;
 
-	if (nt == NULL)
-		perror("queue_dequeue");
+	// Switch to the next thread from the ready queue, which releases @lock
+	thread_switch(next_thread(s), SWITCH_NONE, lock);
+}
+
+// Function to block the current thread, until unblocked or @ns have passed
+int uthread_block_timeout(spinlock_t *lock, uint64_t ns)
+{
+	struct sched *s = sched_self();
+	struct uthread_tcb *self = s->ct;
+	int timeout;
+
+	// Round up to the next tick, so as not to time out early
+	self->timer.expires = (clock_ns() + ns + (1 << TIMER_SHIFT) - 1) >>
+			      TIMER_SHIFT;
+	atomic_store_explicit(&self->timeout, TIMEOUT_PENDING,
+			      memory_order_relaxed);
+	trace_uthread(TRACE_BLOCK, self, 0);
+	self->stats.voluntary++;
+	self->state = blocked;
+	atomic_fetch_add(&nio_total, 1);
+	// The thread switched to adds us to the wheel, then releases @lock
+	thread_switch(next_thread(s), SWITCH_SLEEP, lock);
+
+	// Whoever made us ready set the outcome before
+	timeout = atomic_load_explicit(&self->timeout, memory_order_relaxed);
+	if (timeout == TIMEOUT_EXPIRED) {
+		// Until out of the waiting list, uthread_cancel_timeout() must
+		// keep failing for us
+		spin_lock(lock);
+		list_del(&self->node);
+	}
+	atomic_store_explicit(&self->timeout, TIMEOUT_NONE,
+			      memory_order_relaxed);
+	return timeout == TIMEOUT_EXPIRED ? -1 : 0;
+}
+
+// Function to stop the timer of a thread about to be unblocked
+bool uthread_cancel_timeout(struct uthread_tcb *uthread)
+{
+	int pending = TIMEOUT_PENDING;
+	struct sched *s;
+
+	// Set by the thread itself, under the lock the caller holds
+	if (atomic_load_explicit(&uthread->timeout, memory_order_relaxed) ==
+	    TIMEOUT_NONE)
+		return true;
+	if (!atomic_compare_exchange_strong(&uthread->timeout, &pending,
+					    TIMEOUT_CANCELED))
+		return false;
+
+	// Unless already taken out of the wheel by timers_expire(), which
+	// then leaves it alone
+	s = uthread->timer_sched;
+	spin_lock(&s->timers_lock);
+	if (!list_empty(&uthread->timer.node))
+		wheel_del(&s->timers, &uthread->timer);
+	spin_unlock(&s->timers_lock);
+	atomic_fetch_sub(&nio_total, 1);
+	return true;
+}
 
-	// Prepare the next thread
-	nt->state = running;
+// Function to locate data on the stack of a thread, which isn't running
+void *uthread_stack_addr(struct uthread_tcb *uthread, void *addr)
+{
+#ifdef UTHREAD_CTX_SWITCH_VIA
+	struct sched *s = sched_self();
+	char *sp = uthread->context.sp;
 
-	// Swap contexts
-	struct uthread_tcb *curr = ct;
-	ct = nt;
-	uthread_ctx_switch(curr->ctx, nt->ctx);
+	// Saved by stack_switch(), from its stack pointer up to the top
+	if (uthread->stk_shared && s->stack_owner != uthread &&
+	    (char *)addr >= sp &&
+	    (char *)addr < (char *)s->shared_stack + UTHREAD_SHARED_STACK_SIZE)
+		return (char *)uthread->saved + ((char *)addr - sp);
+#else
+	(void)uthread;
+#endif
+	return addr;
 }
 
 // Function to unblock a thread
@@ -187,9 +1678,26 @@ void uthread_unblock(struct uthread_tcb *uthread)
 		return;
 
 	// Set the thread to ready and enqueue it to the ready queue
-	uthread->state = ready;
-	queue_enqueue(rq, uthread);
+	ready_enqueue(sched_self(), uthread);
 
 	// Yield to the next thread
 	uthread_yield();
 }
+
+// Function to make a thread ready, the current one running on
+void uthread_wake(struct uthread_tcb *uthread)
+{
+	if (uthread != NULL)
+		ready_enqueue(sched_self(), uthread);
+}
+
+// Function to switch to a blocked thread right away, ahead of the ready ones
+void uthread_handoff(struct uthread_tcb *uthread)
+{
+	if (uthread == NULL)
+		return;
+
+	thread_ready(uthread);
+	uthread_current()->stats.voluntary++;
+	thread_switch(uthread, SWITCH_READY, NULL);
+}
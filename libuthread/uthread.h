@@ -2,6 +2,8 @@
 #define _UTHREAD_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /*
  * uthread_func_t - Thread function type
@@ -9,6 +11,102 @@
  */
 typedef void (*uthread_func_t)(void *arg);
 
+/*
+ * uthread_t - Thread handle
+ *
+ * Opaque handle identifying a thread, as returned by uthread_create(). A handle
+ * remains valid until the thread it identifies is joined or detached, or until
+ * uthread_run() returns.
+ */
+typedef struct uthread_tcb *uthread_t;
+
+/*
+ * uthread_clock_t - Clock measuring time slices for preemption
+ *
+ * UTHREAD_CLOCK_VIRTUAL counts the CPU time spent by the process in user mode,
+ * UTHREAD_CLOCK_PROF the CPU time spent by the process in user and kernel mode,
+ * and UTHREAD_CLOCK_MONOTONIC the elapsed wall-clock time.
+ */
+typedef enum {
+	UTHREAD_CLOCK_VIRTUAL,
+	UTHREAD_CLOCK_PROF,
+	UTHREAD_CLOCK_MONOTONIC,
+} uthread_clock_t;
+
+/*
+ * uthread_set_timeslice - Configure preemption
+ * @usec: Length of a time slice, in microseconds
+ * @clock: Clock measuring the time slices
+ * @tickless: Only run the timer when other threads are ready to run
+ *
+ * By default, a running thread is preempted after 10 ms of process CPU time
+ * (@usec is 10000 and @clock is UTHREAD_CLOCK_VIRTUAL), and the timer keeps
+ * ticking even if there is no other thread to switch to. In tickless mode, a
+ * thread running alone doesn't get interrupted at all.
+ *
+ * Must be called before uthread_run(), and is only effective if preemption is
+ * enabled there.
+ *
+ * Return: -1 if @usec is 0, if @clock is invalid, or if preemption is currently
+ * running. 0 otherwise.
+ */
+int uthread_set_timeslice(unsigned long usec, uthread_clock_t clock,
+			  bool tickless);
+
+/*
+ * uthread_set_workers - Configure the number of workers
+ * @workers: Number of kernel threads running the threads
+ *
+ * By default, uthread_run() multiplexes all the threads onto the original
+ * execution thread. With more than one worker, it starts @workers - 1
+ * additional kernel threads (POSIX threads), and the threads are scheduled
+ * across all of them (M:N scheduling): each worker runs the threads from its own
+ * ready queue, and steals ready threads from the other workers when it has none
+ * left. A thread may thus be resumed by another worker than the one it ran on
+ * before.
+ *
+ * With preemption enabled, each worker is preempted by its own timer, counting
+ * the CPU time of the worker for UTHREAD_CLOCK_VIRTUAL and UTHREAD_CLOCK_PROF.
+ *
+ * Must be called before uthread_run().
+ *
+ * Return: -1 if @workers is 0, or if the threads are currently running. 0
+ * otherwise.
+ */
+int uthread_set_workers(unsigned int workers);
+
+/* Maximum number of priority levels */
+#define UTHREAD_PRIO_LEVELS 8
+
+/*
+ * uthread_set_mlfq - Configure the multi-level feedback queue policy
+ * @levels: Number of priority levels, from 1 to UTHREAD_PRIO_LEVELS
+ * @quanta: Quantum of each level, in time slices, or NULL
+ * @boost: Number of time slices between priority boosts, or 0
+ *
+ * Ready threads run by order of priority level, level 0 being the highest, and
+ * in FIFO order within a level. Threads start at level 0, and can move to
+ * another level with uthread_set_priority(). A thread that has run for the
+ * quantum of its level, @quanta[i] time slices of the preemption timer in total,
+ * is demoted to the level below. Every @boost time slices, all the ready threads
+ * get back to level 0, so that the lower levels can't be starved.
+ *
+ * If @quanta is NULL, the quantum of level i is 2^i time slices. By default,
+ * there is a single level with a quantum of one time slice, i.e., plain round
+ * robin. Time slices are only counted when preemption is enabled; otherwise,
+ * only the priorities set by the threads matter.
+ *
+ * Each worker of the M:N scheduler counts its own time slices and boosts its
+ * own ready threads.
+ *
+ * Must be called before uthread_run().
+ *
+ * Return: -1 if @levels is out of range, if a quantum is 0, or if the threads
+ * are currently running. 0 otherwise.
+ */
+int uthread_set_mlfq(unsigned int levels, const unsigned int *quanta,
+		     unsigned int boost);
+
 /*
  * uthread_run - Run the multithreading library
  * @preempt: Preemption enable
@@ -17,12 +115,20 @@ typedef void (*uthread_func_t)(void *arg);
  *
  * This function should only be called by the process' original execution
  * thread. It starts the multithreading scheduling library, and becomes the
- * "idle" thread. It returns once all the threads have finished running.
+ * "idle" thread of the first worker (see uthread_set_workers()). It returns once
+ * all the threads have finished running, or once none of them can run anymore.
+ *
+ * While no thread is ready, the workers sleep in the kernel until a timer
+ * expires, some I/O is ready, or another worker makes a thread ready. If no
+ * thread waits for any of these either, the remaining threads are all blocked
+ * waiting for each other: the deadlock is reported on stderr, and uthread_run()
+ * returns without reclaiming them.
  *
- * If @preempt is `true`, then preemptive scheduling is enabled.
+ * If @preempt is `true`, then preemptive scheduling is enabled, as configured
+ * by uthread_set_timeslice().
  *
  * Return: 0 in case of success, -1 in case of failure (e.g., memory allocation,
- * context creation).
+ * context creation) or of deadlock.
  */
 int uthread_run(bool preempt, uthread_func_t func, void *arg);
 
@@ -32,12 +138,227 @@ int uthread_run(bool preempt, uthread_func_t func, void *arg);
  * @arg: Argument to be passed to the thread
  *
  * This function creates a new thread running the function @func to which
- * argument @arg is passed.
+ * argument @arg is passed. Once terminated, the thread keeps some resources
+ * until it gets joined with uthread_join(), unless it is detached with
+ * uthread_detach().
  *
- * Return: 0 in case of success, -1 in case of failure (e.g., memory allocation,
- * context creation).
+ * Return: Handle of the new thread, or NULL in case of failure (e.g., memory
+ * allocation, context creation).
+ */
+uthread_t uthread_create(uthread_func_t func, void *arg);
+
+/* Default size of the stack of a thread (in bytes) */
+#define UTHREAD_STACK_SIZE 32768
+
+/* Minimum size of the stack of a thread (in bytes) */
+#define UTHREAD_STACK_MIN 8192
+
+/* Maximum length of the name of a thread, including the terminating null byte */
+#define UTHREAD_NAME_MAX 16
+
+/* Size of the stack shared by the threads created with a shared stack */
+#define UTHREAD_SHARED_STACK_SIZE (1 << 20)
+
+/*
+ * uthread_attr_t - Thread creation attributes
+ * @stack_size: Size of the stack (in bytes), 0 for UTHREAD_STACK_SIZE
+ * @stack: Lowest address of a stack of @stack_size bytes provided by the
+ *	caller, or NULL to have one allocated
+ * @name: Name of the thread, for debugging, or NULL
+ * @priority: Initial priority level, 0 being the highest (see
+ *	uthread_set_mlfq())
+ * @shared_stack: Run on a stack shared with the other threads created with
+ *	@shared_stack, instead of a stack of its own
+ *
+ * Allocated stacks have their size rounded up (to a power of two, for stacks up
+ * to 8 MiB), and are guarded against overflows. A stack provided by the caller
+ * is used as is, and must remain valid until the thread is joined, or until
+ * uthread_run() returns if it is detached.
+ *
+ * Threads with @shared_stack (whose @stack_size and @stack are ignored) all run
+ * on the same stack of UTHREAD_SHARED_STACK_SIZE bytes. When one of them gets to
+ * run after another, the part of the stack the latter was using is copied to the
+ * heap, and the part of the former copied back from there. This trades some time
+ * at every such switch for the memory of mostly idle threads, which only keep
+ * the few hundred bytes they actually use. Since their stack variables move
+ * around, the addresses of these variables must not be used by other threads
+ * while they are switched out (which rules out the io_uring backend, see
+ * uthread_set_io_uring()). Shared stacks require a single worker (see
+ * uthread_set_workers()).
+ */
+typedef struct uthread_attr {
+	size_t stack_size;
+	void *stack;
+	const char *name;
+	unsigned int priority;
+	bool shared_stack;
+} uthread_attr_t;
+
+/*
+ * uthread_attr_init - Initialize thread creation attributes
+ * @attr: Attributes to initialize
+ *
+ * Set @attr to the attributes of the threads created by uthread_create().
+ */
+void uthread_attr_init(uthread_attr_t *attr);
+
+/*
+ * uthread_create_attr - Create a new thread with some attributes
+ * @attr: Attributes of the thread, or NULL for the default ones
+ * @func: Function to be executed by the thread
+ * @arg: Argument to be passed to the thread
+ *
+ * Like uthread_create(), but with the attributes @attr. @attr may be reused or
+ * freed as soon as the function returns, the name being copied (and truncated
+ * to UTHREAD_NAME_MAX - 1 characters). A priority beyond the lowest level of the
+ * scheduling policy is clamped to that level.
+ *
+ * Return: Handle of the new thread, or NULL in case of failure (e.g., memory
+ * allocation, context creation, stack smaller than UTHREAD_STACK_MIN, shared
+ * stack with several workers).
+ */
+uthread_t uthread_create_attr(const uthread_attr_t *attr, uthread_func_t func,
+			      void *arg);
+
+/*
+ * uthread_get_name - Get the name of a thread
+ * @uthread: Handle of the thread
+ *
+ * Return: Name given to @uthread at its creation, or an empty string if none
+ */
+const char *uthread_get_name(uthread_t uthread);
+
+/*
+ * uthread_stats_t - Execution statistics of a thread
+ * @run_ns: Time spent running (in nanoseconds)
+ * @ready_ns: Time spent in the ready queue, waiting to run
+ * @blocked_ns: Time spent blocked (on semaphores, joins, I/O or sleeps)
+ * @voluntary: Number of times the thread yielded or blocked
+ * @preempted: Number of times the thread was preempted by the timer
+ * @sem_waits: Number of times the thread blocked on a semaphore
+ *
+ * The times are only measured when enabled with uthread_set_stats(), and are
+ * otherwise 0. The counters are always maintained.
+ */
+typedef struct uthread_stats {
+	uint64_t run_ns;
+	uint64_t ready_ns;
+	uint64_t blocked_ns;
+	uint64_t voluntary;
+	uint64_t preempted;
+	uint64_t sem_waits;
+} uthread_stats_t;
+
+/*
+ * uthread_sched_stats_t - Execution statistics of the scheduler
+ * @total: Sum of the statistics of all the threads created by the current (or
+ *	last) call to uthread_run(), terminated ones included
+ * @idle_ns: Time the workers spent with no thread to run, summed over workers
+ * @threads: Number of threads not terminated yet
+ * @workers: Number of workers
+ */
+typedef struct uthread_sched_stats {
+	uthread_stats_t total;
+	uint64_t idle_ns;
+	uint64_t threads;
+	unsigned int workers;
+} uthread_sched_stats_t;
+
+/*
+ * uthread_stats_func_t - Function called for every thread by
+ * uthread_stats_foreach()
  */
-int uthread_create(uthread_func_t func, void *arg);
+typedef void (*uthread_stats_func_t)(uthread_t uthread,
+				     const uthread_stats_t *stats, void *arg);
+
+/*
+ * uthread_set_stats - Configure the time accounting
+ * @enable: Measure the time each thread spends running, ready and blocked
+ *
+ * Measuring times takes a clock reading at every context switch and every time
+ * a thread gets unblocked, which is why it is disabled by default. Only takes
+ * effect at the next call to uthread_run().
+ *
+ * Return: -1 if called while uthread_run() is running, 0 otherwise
+ */
+int uthread_set_stats(bool enable);
+
+/*
+ * uthread_stats_get - Get the execution statistics of a thread
+ * @uthread: Handle of the thread
+ * @stats: Where to store the statistics
+ *
+ * The statistics include the time spent so far in the current state of
+ * @uthread. They can be read until @uthread is joined (or terminates, if it is
+ * detached).
+ *
+ * Return: -1 if @uthread or @stats is NULL, 0 otherwise
+ */
+int uthread_stats_get(uthread_t uthread, uthread_stats_t *stats);
+
+/*
+ * uthread_stats_foreach - Get the execution statistics of all threads
+ * @func: Function to call for each thread
+ * @arg: Argument to pass to @func
+ *
+ * Call @func for every thread created by the current call to uthread_run() and
+ * not joined yet (nor terminated, if detached), with a copy of its statistics.
+ * With several workers, the statistics of the threads running on other workers
+ * may be slightly out of date.
+ *
+ * Return: -1 if not called from a thread, 0 otherwise
+ */
+int uthread_stats_foreach(uthread_stats_func_t func, void *arg);
+
+/*
+ * uthread_sched_stats_get - Get the execution statistics of the scheduler
+ * @stats: Where to store the statistics
+ *
+ * Can also be called once uthread_run() returned, to get the statistics of the
+ * whole run.
+ *
+ * Return: -1 if @stats is NULL, or if uthread_run() was never called. 0
+ * otherwise.
+ */
+int uthread_sched_stats_get(uthread_sched_stats_t *stats);
+
+/*
+ * uthread_self - Get the currently running thread
+ *
+ * Return: Handle of the currently running thread, or NULL if not called from a
+ * thread.
+ */
+uthread_t uthread_self(void);
+
+/*
+ * uthread_join - Wait for a thread to terminate
+ * @uthread: Thread to wait for
+ * @retval: Address where to store the exit value of @uthread, or NULL
+ *
+ * This function blocks the currently running thread until @uthread terminates,
+ * unless it already has. The exit value of @uthread is the value it passed to
+ * uthread_exit(), or NULL if it returned from its function. The resources of
+ * @uthread are then released, and @uthread becomes invalid.
+ *
+ * A thread can only be joined once, and not once detached.
+ *
+ * Return: -1 if @uthread is NULL, detached, already being joined, or the
+ * currently running thread, or if not called from a thread. 0 otherwise.
+ */
+int uthread_join(uthread_t uthread, void **retval);
+
+/*
+ * uthread_detach - Detach a thread
+ * @uthread: Thread to detach
+ *
+ * This function marks @uthread so that its resources are released as soon as
+ * it terminates, or right away if it already has. @uthread can't be joined
+ * anymore, and becomes invalid once terminated.
+ *
+ * Return: -1 if @uthread is NULL, already detached, or being joined. 0
+ * otherwise.
+ */
+int uthread_detach(uthread_t uthread);
 
 /*
  * uthread_yield - Yield execution
@@ -47,14 +368,102 @@ int uthread_create(uthread_func_t func, void *arg);
  */
 void uthread_yield(void);
 
+/*
+ * uthread_sleep_ns - Sleep for some time
+ * @ns: Duration of the sleep, in nanoseconds
+ *
+ * The currently running thread is blocked for at least @ns nanoseconds,
+ * without using the CPU. Timers have a resolution of about 16 microseconds.
+ *
+ * Return: -1 if not called from a thread, 0 otherwise
+ */
+int uthread_sleep_ns(uint64_t ns);
+
+/*
+ * uthread_sleep_until - Sleep until some point in time
+ * @deadline: Time to wake up at, in nanoseconds of the CLOCK_MONOTONIC clock
+ *
+ * Like uthread_sleep_ns(), but until an absolute deadline, so that periodic
+ * threads don't drift. If @deadline has passed already, the thread only yields.
+ *
+ * Return: -1 if not called from a thread, 0 otherwise
+ */
+int uthread_sleep_until(uint64_t deadline);
+
+/*
+ * uthread_set_priority - Set the priority of the current thread
+ * @level: Priority level, 0 being the highest
+ *
+ * This function moves the currently running thread to priority level @level,
+ * with a fresh quantum. From there, the thread gets demoted and boosted like
+ * any other (see uthread_set_mlfq()). If a thread of higher priority is ready
+ * to run, the current thread yields to it.
+ *
+ * Return: -1 if @level is not lower than the number of priority levels, or if
+ * not called from a thread. 0 otherwise.
+ */
+int uthread_set_priority(unsigned int level);
+
 /*
  * uthread_exit - Exit from currently running thread
+ * @retval: Exit value, for the thread joining this one
  *
  * This function is to be called from the currently active and running thread in
- * order to finish its execution.
+ * order to finish its execution. Returning from the function of the thread is
+ * equivalent to calling uthread_exit(NULL).
  *
  * This function shall never return.
  */
-void uthread_exit(void);
+void uthread_exit(void *retval);
+
+/*
+ * uthread_set_stack_cache - Configure the stack cache
+ * @max_stacks: Maximum number of free stacks of each size kept around for reuse
+ *
+ * Stacks of exited threads are kept in a cache so that they can be reused by
+ * threads created afterwards, up to @max_stacks of them per stack size (1024 by
+ * default). Stacks released while the cache is full, and stacks bigger than
+ * 8 MiB, are returned to the system. Setting @max_stacks to 0 disables the
+ * cache. Only the first few cached stacks stay resident: the others keep a
+ * single page in memory, but still count as two mappings of the process.
+ *
+ * Each worker of the M:N scheduler has a cache of its own, up to @max_stacks.
+ * Lowering @max_stacks trims the cache of the calling worker right away, and
+ * the caches of the other workers the next time they create or free a thread.
+ */
+void uthread_set_stack_cache(size_t max_stacks);
+
+/*
+ * uthread_set_trace - Configure the scheduler event trace
+ * @records: Number of events kept per worker, 0 to disable tracing
+ *
+ * When the library is built with tracing (`make TRACE=1`), every worker records
+ * the scheduler events (thread creations, switches, blocking and unblocking,
+ * terminations, preemptions, semaphore waits and posts) in a ring of @records
+ * entries (rounded up to a power of two, 65536 by default), overwriting the
+ * oldest ones once full. Recording an event takes about 30 to 40 nanoseconds,
+ * most of which is reading the time stamp counter (about 25 ns in a virtual
+ * machine, much less on bare metal). Without tracing, the trace points compile
+ * to nothing. Only takes effect at the next call to uthread_run().
+ *
+ * Return: -1 if the library is built without tracing, or if @records is too
+ * large. 0 otherwise.
+ */
+int uthread_set_trace(size_t records);
+
+/*
+ * uthread_trace_dump - Export the scheduler event trace
+ * @path: File to write the trace to
+ *
+ * Write the events recorded by the workers during the current (or last) call to
+ * uthread_run() to @path, in the Chrome trace event format that
+ * chrome://tracing and Perfetto load. Each worker is a track, on which the runs
+ * of the threads are slices and the other events are instants. Can be called
+ * while threads run, in which case the events recorded meanwhile may be missed.
+ *
+ * Return: -1 if the library is built without tracing, if nothing was traced,
+ * or in case of failure to write @path. 0 otherwise.
+ */
+int uthread_trace_dump(const char *path);
 
 #endif /* _THREAD_H */
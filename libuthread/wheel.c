@@ -0,0 +1,138 @@
+#include <stdint.h>
+
+#include "wheel.h"
+
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+
+/* Rotate the bitmap of a level so that slot @idx becomes bit 0 */
+static uint64_t wheel_ror(uint64_t bitmap, unsigned int idx)
+{
+	if (idx == 0)
+		return bitmap;
+	return (bitmap >> idx) | (bitmap << (WHEEL_SIZE - idx));
+}
+
+void wheel_init(struct wheel *w, uint64_t now)
+{
+	w->current = now;
+	w->count = 0;
+	for (unsigned int level = 0; level < WHEEL_LEVELS; level++) {
+		w->bitmap[level] = 0;
+		for (unsigned int slot = 0; slot < WHEEL_SIZE; slot++)
+			list_init(&w->slots[level][slot]);
+	}
+}
+
+/* Insert a timer in the finest level reaching its expiry */
+static void wheel_insert(struct wheel *w, struct wheel_timer *t)
+{
+	uint64_t expires = t->expires < w->current ? w->current : t->expires;
+	uint64_t index = expires;
+	unsigned int level;
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		unsigned int shift = level * WHEEL_BITS;
+
+		index = expires >> shift;
+		if (index - (w->current >> shift) < WHEEL_SIZE)
+			break;
+	}
+	if (level == WHEEL_LEVELS) {
+		/* Too far away: park it in the last slot, cascaded in time */
+		level--;
+		index = (w->current >> (level * WHEEL_BITS)) + WHEEL_SIZE - 1;
+	}
+
+	t->level = level;
+	t->slot = index & WHEEL_MASK;
+	list_add_tail(&t->node, &w->slots[level][t->slot]);
+	w->bitmap[level] |= UINT64_C(1) << t->slot;
+}
+
+void wheel_add(struct wheel *w, struct wheel_timer *t)
+{
+	wheel_insert(w, t);
+	w->count++;
+}
+
+void wheel_del(struct wheel *w, struct wheel_timer *t)
+{
+	list_del(&t->node);
+	if (list_empty(&w->slots[t->level][t->slot]))
+		w->bitmap[t->level] &= ~(UINT64_C(1) << t->slot);
+	w->count--;
+}
+
+uint64_t wheel_next(struct wheel *w)
+{
+	uint64_t next = UINT64_MAX;
+	uint64_t bits;
+
+	if (w->count == 0)
+		return UINT64_MAX;
+
+	/* Level 0 holds the next WHEEL_SIZE ticks, starting from the current one */
+	bits = wheel_ror(w->bitmap[0], w->current & WHEEL_MASK);
+	if (bits)
+		next = w->current + __builtin_ctzll(bits);
+
+	/*
+	 * Slots of the other levels start strictly after the current one, and
+	 * are cascaded when the wheel reaches their first tick
+	 */
+	for (unsigned int level = 1; level < WHEEL_LEVELS; level++) {
+		unsigned int shift = level * WHEEL_BITS;
+		uint64_t base = w->current >> shift;
+		uint64_t tick;
+
+		bits = wheel_ror(w->bitmap[level], (base + 1) & WHEEL_MASK);
+		if (!bits)
+			continue;
+		tick = (base + 1 + __builtin_ctzll(bits)) << shift;
+		if (tick < next)
+			next = tick;
+	}
+	return next;
+}
+
+/* Move the timers of a slot to the finer levels */
+static void wheel_cascade(struct wheel *w, unsigned int level, unsigned int slot)
+{
+	struct list_head *head = &w->slots[level][slot];
+	struct list_head *node, *next;
+
+	w->bitmap[level] &= ~(UINT64_C(1) << slot);
+	list_for_each_safe(node, next, head) {
+		list_del(node);
+		wheel_insert(w, list_entry(node, struct wheel_timer, node));
+	}
+}
+
+void wheel_advance(struct wheel *w, uint64_t now, struct list_head *expired)
+{
+	uint64_t tick;
+
+	/* Jump from event to event, no timer being in the ticks in between */
+	while ((tick = wheel_next(w)) <= now) {
+		struct list_head *head;
+
+		w->current = tick;
+		for (unsigned int level = WHEEL_LEVELS - 1; level > 0; level--) {
+			unsigned int shift = level * WHEEL_BITS;
+
+			if ((tick & ((UINT64_C(1) << shift) - 1)) == 0)
+				wheel_cascade(w, level,
+					      (tick >> shift) & WHEEL_MASK);
+		}
+
+		head = &w->slots[0][tick & WHEEL_MASK];
+		while (!list_empty(head)) {
+			list_add_tail(list_pop(head), expired);
+			w->count--;
+		}
+		w->bitmap[0] &= ~(UINT64_C(1) << (tick & WHEEL_MASK));
+	}
+
+	if (w->current < now)
+		w->current = now;
+}
@@ -0,0 +1,86 @@
+#ifndef _UTHREAD_WHEEL_H
+#define _UTHREAD_WHEEL_H
+
+/*
+ * Hierarchical timing wheel
+ *
+ * Timers are kept in WHEEL_LEVELS wheels of WHEEL_SIZE slots each, as described
+ * by Varghese and Lauck ("Hashed and Hierarchical Timing Wheels", SOSP 1987).
+ * Slots of level 0 are one tick wide, slots of each next level are WHEEL_SIZE
+ * times wider than those of the previous one. A timer goes to the level whose
+ * slots are the finest that can still reach its expiry, and is moved down a
+ * level ("cascaded") whenever the wheel reaches the beginning of its slot.
+ * Adding and deleting a timer are O(1), and so is expiring each timer, up to
+ * its WHEEL_LEVELS - 1 cascades.
+ *
+ * A bitmap of the non-empty slots of each level lets the wheel skip empty
+ * slots, instead of stepping through every tick.
+ *
+ * Like the rest of the private headers, this is only meant to be used within
+ * libuthread.
+ */
+
+#include <stdint.h>
+
+#include "list.h"
+
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)	/* Slots per level, one bitmap word */
+#define WHEEL_LEVELS 6			/* Covers 2^36 ticks */
+
+struct wheel_timer {
+	struct list_head node;		/* Link in its slot */
+	uint64_t expires;		/* Tick at which the timer expires */
+	unsigned char level, slot;	/* Slot the timer is in */
+};
+
+struct wheel {
+	uint64_t current;		/* Tick up to which timers expired */
+	unsigned int count;		/* Number of timers */
+	uint64_t bitmap[WHEEL_LEVELS];	/* Non-empty slots of each level */
+	struct list_head slots[WHEEL_LEVELS][WHEEL_SIZE];
+};
+
+/*
+ * wheel_init - Initialize an empty wheel
+ * @w: Wheel to initialize
+ * @now: Current tick
+ */
+void wheel_init(struct wheel *w, uint64_t now);
+
+/*
+ * wheel_add - Add a timer to a wheel
+ * @w: Wheel to add to
+ * @t: Timer to add, with its expires field set
+ *
+ * A timer expiring in the past expires at the next call to wheel_advance().
+ */
+void wheel_add(struct wheel *w, struct wheel_timer *t);
+
+/*
+ * wheel_del - Delete a timer from a wheel
+ * @w: Wheel to delete from
+ * @t: Timer to delete, which must be in @w
+ */
+void wheel_del(struct wheel *w, struct wheel_timer *t);
+
+/*
+ * wheel_next - Tick at which a wheel next needs to be advanced
+ * @w: Wheel to check
+ *
+ * That is when its first timer expires, or possibly earlier, when its first
+ * timer needs to be cascaded.
+ *
+ * Return: Tick of the next event, or UINT64_MAX if @w is empty
+ */
+uint64_t wheel_next(struct wheel *w);
+
+/*
+ * wheel_advance - Expire the timers of a wheel up to some tick
+ * @w: Wheel to advance
+ * @now: Current tick
+ * @expired: List to which the timers expiring at or before @now are moved
+ */
+void wheel_advance(struct wheel *w, uint64_t now, struct list_head *expired);
+
+#endif /* _UTHREAD_WHEEL_H */